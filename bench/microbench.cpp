@@ -0,0 +1,212 @@
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "in_process_client.h"
+#include "json.hpp"
+#include "packet.h"
+#include "record_parser.h"
+
+namespace tinymq {
+class Session;
+}
+
+namespace {
+
+using SessionPtr = std::shared_ptr<tinymq::Session>;
+using TopicSubscribers = std::unordered_map<std::string, std::vector<SessionPtr>>;
+
+std::vector<uint8_t> make_publish_payload(const std::string& topic, size_t message_size) {
+    std::vector<uint8_t> payload;
+    payload.reserve(1 + topic.size() + message_size);
+    payload.push_back(static_cast<uint8_t>(topic.size()));
+    payload.insert(payload.end(), topic.begin(), topic.end());
+    payload.resize(payload.size() + message_size, 'x');
+    return payload;
+}
+
+// Session cannot be built without a socket and broker. Aliasing an int's
+// control block gives a SessionPtr whose copies touch a real refcount,
+// which is the cost being measured.
+std::vector<SessionPtr> make_subscribers(size_t count) {
+    std::vector<SessionPtr> subscribers;
+    subscribers.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        subscribers.emplace_back(std::make_shared<int>(0), nullptr);
+    }
+    return subscribers;
+}
+
+TopicSubscribers make_topic_table(size_t topic_count) {
+    TopicSubscribers table;
+    for (size_t i = 0; i < topic_count; ++i) {
+        table["site/" + std::to_string(i / 100) + "/sensor/" + std::to_string(i)] = make_subscribers(1);
+    }
+    return table;
+}
+
+void BM_PacketSerialize(benchmark::State& state) {
+    tinymq::Packet packet(tinymq::PacketType::PUB, 0, make_publish_payload("site/1/temp", state.range(0)));
+    for (auto _ : state) {
+        auto frame = packet.serialize();
+        benchmark::DoNotOptimize(frame.data());
+    }
+    state.SetBytesProcessed(state.iterations() * (packet.payload().size() + 4));
+}
+BENCHMARK(BM_PacketSerialize)->Arg(16)->Arg(256)->Arg(4096)->Arg(60000);
+
+void BM_PacketDeserialize(benchmark::State& state) {
+    tinymq::Packet source(tinymq::PacketType::PUB, 0, make_publish_payload("site/1/temp", state.range(0)));
+    auto frame = source.serialize();
+    tinymq::Packet packet;
+    for (auto _ : state) {
+        bool ok = packet.deserialize(frame);
+        benchmark::DoNotOptimize(ok);
+    }
+    state.SetBytesProcessed(state.iterations() * frame.size());
+}
+BENCHMARK(BM_PacketDeserialize)->Arg(16)->Arg(256)->Arg(4096)->Arg(60000);
+
+void BM_ParsePublish(benchmark::State& state) {
+    auto payload = make_publish_payload("site/1/sensor/temperature", state.range(0));
+    for (auto _ : state) {
+        // Fresh objects each time, as Session::handle_publish does
+        std::string topic;
+        std::vector<uint8_t> message;
+        bool ok = tinymq::parse_publish(payload, topic, message);
+        benchmark::DoNotOptimize(ok);
+        benchmark::DoNotOptimize(topic.data());
+        benchmark::DoNotOptimize(message.data());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_ParsePublish)->Arg(16)->Arg(256)->Arg(4096);
+
+void BM_TopicLookup(benchmark::State& state) {
+    auto table = make_topic_table(state.range(0));
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < 1024; ++i) {
+        size_t index = (i * 7919) % state.range(0);
+        keys.push_back("site/" + std::to_string(index / 100) + "/sensor/" + std::to_string(index));
+    }
+    size_t next = 0;
+    for (auto _ : state) {
+        auto it = table.find(keys[next++ & 1023]);
+        benchmark::DoNotOptimize(it);
+    }
+}
+BENCHMARK(BM_TopicLookup)->Arg(10)->Arg(1000)->Arg(100000);
+
+void BM_SubscriberCopy(benchmark::State& state) {
+    auto subscribers = make_subscribers(state.range(0));
+    for (auto _ : state) {
+        std::vector<SessionPtr> copy = subscribers;
+        benchmark::DoNotOptimize(copy.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SubscriberCopy)->RangeMultiplier(4)->Range(1, 4096);
+
+// Publish to one in-process subscriber through a broker that is not started
+void BM_InProcessPublish(benchmark::State& state) {
+    tinymq::Broker broker(0, 1);
+    tinymq::InProcessClient publisher(broker);
+    tinymq::InProcessClient subscriber(broker);
+    size_t received = 0;
+    subscriber.subscribe("site/1/sensor/7", [&](const std::string&, const tinymq::InProcessClient::Message& message) {
+        received += message->size();
+    });
+    auto message = std::make_shared<const std::vector<uint8_t>>(state.range(0), 'x');
+    for (auto _ : state) {
+        publisher.publish("site/1/sensor/7", message);
+    }
+    benchmark::DoNotOptimize(received);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_InProcessPublish)->Arg(64)->Arg(4096);
+
+// Lines as sent by the ESP32 devices: a topic per device and reading, and a
+// data field of roughly the requested size made of key=value readings
+std::vector<std::string> make_sensor_lines(size_t data_size) {
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < 256; ++i) {
+        std::string data = "ts=" + std::to_string(1718000000 + i);
+        while (data.size() < data_size) {
+            data += ";t" + std::to_string(data.size() % 7) + "=" + std::to_string(20 + i % 10) + "." +
+                    std::to_string(i % 100);
+        }
+        lines.push_back("{\"topic\": \"site/" + std::to_string(i % 8) + "/esp32-" + std::to_string(i) +
+                        "/temperature\", \"data\": \"" + data + "\"}");
+    }
+    return lines;
+}
+
+// The gateway's original path: a DOM parse and copies of both fields
+void BM_GatewayParseJson(benchmark::State& state) {
+    auto lines = make_sensor_lines(state.range(0));
+    size_t next = 0;
+    for (auto _ : state) {
+        auto parsed = nlohmann::json::parse(lines[next++ & 255]);
+        std::string topic = parsed["topic"];
+        std::string data = parsed["data"];
+        benchmark::DoNotOptimize(topic.data());
+        benchmark::DoNotOptimize(data.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GatewayParseJson)->Arg(16)->Arg(64)->Arg(512);
+
+void BM_GatewayParseRecord(benchmark::State& state) {
+    auto lines = make_sensor_lines(state.range(0));
+    tinymq::gateway::SensorRecord record;
+    size_t next = 0;
+    for (auto _ : state) {
+        tinymq::gateway::parse_record(lines[next++ & 255], record);
+        benchmark::DoNotOptimize(record.topic.data());
+        benchmark::DoNotOptimize(record.data.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GatewayParseRecord)->Arg(16)->Arg(64)->Arg(512);
+
+// Escaped data takes the fallback; this is its cost over the plain parse
+void BM_GatewayParseRecordFallback(benchmark::State& state) {
+    auto lines = make_sensor_lines(state.range(0));
+    for (auto& line : lines) {
+        line.insert(line.size() - 2, "\\n");
+    }
+    tinymq::gateway::SensorRecord record;
+    size_t next = 0;
+    for (auto _ : state) {
+        tinymq::gateway::parse_record(lines[next++ & 255], record);
+        benchmark::DoNotOptimize(record.data.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GatewayParseRecordFallback)->Arg(64);
+
+// The same records as binary frames for --ingest cbor and msgpack
+void BM_GatewayParseBinary(benchmark::State& state, tinymq::gateway::RecordEncoding encoding) {
+    std::vector<std::string> frames;
+    for (const auto& line : make_sensor_lines(state.range(0))) {
+        auto parsed = nlohmann::json::parse(line);
+        auto frame = encoding == tinymq::gateway::RecordEncoding::cbor ? nlohmann::json::to_cbor(parsed)
+                                                                       : nlohmann::json::to_msgpack(parsed);
+        frames.emplace_back(reinterpret_cast<const char*>(frame.data()), frame.size());
+    }
+    tinymq::gateway::SensorRecord record;
+    size_t next = 0;
+    for (auto _ : state) {
+        tinymq::gateway::parse_record(frames[next++ & 255], record, encoding);
+        benchmark::DoNotOptimize(record.topic.data());
+        benchmark::DoNotOptimize(record.data.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_GatewayParseBinary, cbor, tinymq::gateway::RecordEncoding::cbor)->Arg(16)->Arg(64)->Arg(512);
+BENCHMARK_CAPTURE(BM_GatewayParseBinary, msgpack, tinymq::gateway::RecordEncoding::msgpack)->Arg(16)->Arg(64)->Arg(512);
+
+} // namespace
+
+BENCHMARK_MAIN();
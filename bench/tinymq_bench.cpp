@@ -0,0 +1,470 @@
+#include <boost/asio.hpp>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "histogram.h"
+#include "packet.h"
+
+using boost::asio::ip::tcp;
+using bench_clock = std::chrono::steady_clock;
+
+namespace {
+
+enum class Mode { Closed, Open };
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 1505;
+    size_t publishers = 1;
+    size_t subscribers = 1;
+    size_t topics = 1;
+    size_t fanout = 0;              // Subscribers per topic; 0 means every subscriber
+    size_t message_size = 64;
+    double rate = 0.0;              // Messages per second per publisher; 0 means unlimited
+    Mode mode = Mode::Closed;
+    double duration = 10.0;
+    double warmup = 1.0;
+    bool json = false;
+};
+
+// Every message starts with this header so subscribers can compute latency
+struct MessageStamp {
+    int64_t sent_ns;                // Intended send time in open loop, actual send time in closed loop
+    uint32_t publisher;
+    uint32_t sequence;
+};
+
+constexpr size_t header_length = 4;
+
+int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        bench_clock::now().time_since_epoch()).count();
+}
+
+std::string topic_name(size_t index) {
+    return "bench/" + std::to_string(index);
+}
+
+void send_packet(tcp::socket& socket, tinymq::PacketType type, const std::vector<uint8_t>& payload) {
+    tinymq::Packet packet(type, 0, payload);
+    boost::asio::write(socket, boost::asio::buffer(packet.serialize()));
+}
+
+tinymq::PacketType read_packet(tcp::socket& socket, std::vector<uint8_t>& payload) {
+    uint8_t header[header_length];
+    boost::asio::read(socket, boost::asio::buffer(header, header_length));
+    uint16_t length = (static_cast<uint16_t>(header[2]) << 8) | header[3];
+    payload.resize(length);
+    if (length > 0) {
+        boost::asio::read(socket, boost::asio::buffer(payload.data(), length));
+    }
+    return static_cast<tinymq::PacketType>(header[0]);
+}
+
+void expect_packet(tcp::socket& socket, tinymq::PacketType expected) {
+    std::vector<uint8_t> payload;
+    while (read_packet(socket, payload) != expected) {
+    }
+}
+
+std::unique_ptr<tcp::socket> open_session(boost::asio::io_context& io, const Options& options,
+                                          const std::string& client_id) {
+    auto socket = std::make_unique<tcp::socket>(io);
+    tcp::resolver resolver(io);
+    boost::asio::connect(*socket, resolver.resolve(options.host, std::to_string(options.port)));
+    socket->set_option(tcp::no_delay(true));
+
+    send_packet(*socket, tinymq::PacketType::CONN, std::vector<uint8_t>(client_id.begin(), client_id.end()));
+    expect_packet(*socket, tinymq::PacketType::CONNACK);
+    return socket;
+}
+
+void shutdown_socket(tcp::socket& socket) {
+    // Unblocks a reader sitting in a blocking read on another thread
+    ::shutdown(socket.native_handle(), SHUT_RDWR);
+}
+
+// Stops a reader thread on every way out of the scope, including an
+// exception, so a joinable std::thread is never destroyed
+class ReaderJoiner {
+public:
+    ReaderJoiner(std::thread& thread, tcp::socket& socket) : thread_(thread), socket_(socket) {}
+    ~ReaderJoiner() {
+        if (thread_.joinable()) {
+            shutdown_socket(socket_);
+            thread_.join();
+        }
+    }
+
+    ReaderJoiner(const ReaderJoiner&) = delete;
+    ReaderJoiner& operator=(const ReaderJoiner&) = delete;
+
+private:
+    std::thread& thread_;
+    tcp::socket& socket_;
+};
+
+struct Shared {
+    std::atomic<size_t> ready{0};
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop_publishing{false};
+    int64_t measure_start_ns = 0;
+    int64_t measure_end_ns = 0;
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> received{0};
+    std::atomic<uint64_t> received_bytes{0};
+    std::atomic<size_t> errors{0};
+    std::mutex merge_mutex;
+    tinymq::metrics::HistogramSnapshot latency;
+};
+
+void wait_for_start(Shared& shared, bool& counted) {
+    counted = true;
+    shared.ready.fetch_add(1);
+    while (!shared.go.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+bool in_window(const Shared& shared, int64_t sent_ns) {
+    return sent_ns >= shared.measure_start_ns && sent_ns < shared.measure_end_ns;
+}
+
+std::vector<uint8_t> build_payload(const std::string& topic, size_t message_size) {
+    std::vector<uint8_t> payload(1 + topic.size() + message_size, 'x');
+    payload[0] = static_cast<uint8_t>(topic.size());
+    std::copy(topic.begin(), topic.end(), payload.begin() + 1);
+    return payload;
+}
+
+void stamp_payload(std::vector<uint8_t>& payload, size_t offset, const MessageStamp& stamp) {
+    std::memcpy(payload.data() + offset, &stamp, sizeof(stamp));
+}
+
+void run_subscriber(const Options& options, size_t index, Shared& shared,
+                    std::vector<tcp::socket*>& sockets, std::mutex& sockets_mutex) {
+    auto histogram = std::make_unique<tinymq::metrics::Histogram>();
+    bool counted = false;
+    try {
+        boost::asio::io_context io;
+        auto socket = open_session(io, options, "bench_sub_" + std::to_string(index));
+
+        size_t fanout = options.fanout == 0 ? options.subscribers : options.fanout;
+        for (size_t topic = 0; topic < options.topics; ++topic) {
+            for (size_t k = 0; k < fanout; ++k) {
+                if ((topic * fanout + k) % options.subscribers == index) {
+                    auto name = topic_name(topic);
+                    send_packet(*socket, tinymq::PacketType::SUB, std::vector<uint8_t>(name.begin(), name.end()));
+                    expect_packet(*socket, tinymq::PacketType::SUBACK);
+                    break;
+                }
+            }
+        }
+
+        tcp::socket& reader = *socket;
+        {
+            std::lock_guard<std::mutex> lock(sockets_mutex);
+            sockets.push_back(socket.get());
+        }
+
+        wait_for_start(shared, counted);
+
+        std::vector<uint8_t> payload;
+        uint64_t received = 0;
+        uint64_t received_bytes = 0;
+        boost::system::error_code ec;
+        while (true) {
+            uint8_t header[header_length];
+            boost::asio::read(reader, boost::asio::buffer(header, header_length), ec);
+            if (ec) {
+                break;
+            }
+            uint16_t length = (static_cast<uint16_t>(header[2]) << 8) | header[3];
+            payload.resize(length);
+            boost::asio::read(reader, boost::asio::buffer(payload.data(), length), ec);
+            if (ec) {
+                break;
+            }
+            if (static_cast<tinymq::PacketType>(header[0]) != tinymq::PacketType::PUB || payload.empty()) {
+                continue;
+            }
+
+            size_t offset = 1 + payload[0];
+            if (payload.size() < offset + sizeof(MessageStamp)) {
+                continue;
+            }
+
+            MessageStamp stamp;
+            std::memcpy(&stamp, payload.data() + offset, sizeof(stamp));
+            if (in_window(shared, stamp.sent_ns)) {
+                int64_t latency = now_ns() - stamp.sent_ns;
+                histogram->record(latency > 0 ? static_cast<uint64_t>(latency) : 0);
+                ++received;
+                received_bytes += payload.size() - offset;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(sockets_mutex);
+            sockets.erase(std::find(sockets.begin(), sockets.end(), socket.get()));
+        }
+
+        shared.received.fetch_add(received);
+        shared.received_bytes.fetch_add(received_bytes);
+    } catch (const std::exception& e) {
+        std::cerr << "Subscriber " << index << ": " << e.what() << std::endl;
+        shared.errors.fetch_add(1);
+        if (!counted) {
+            shared.ready.fetch_add(1);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(shared.merge_mutex);
+    shared.latency.merge(*histogram);
+}
+
+void run_publisher(const Options& options, size_t index, Shared& shared) {
+    bool counted = false;
+    try {
+        boost::asio::io_context io;
+        auto socket = open_session(io, options, "bench_pub_" + std::to_string(index));
+
+        auto topic = topic_name(index % options.topics);
+        auto payload = build_payload(topic, options.message_size);
+        size_t stamp_offset = 1 + topic.size();
+
+        // Open loop keeps sending on schedule regardless of acknowledgements,
+        // so PUBACKs are drained on a separate thread
+        std::thread drain;
+        if (options.mode == Mode::Open) {
+            drain = std::thread([&socket]() {
+                std::vector<uint8_t> ignored;
+                try {
+                    while (true) {
+                        read_packet(*socket, ignored);
+                    }
+                } catch (const std::exception&) {
+                }
+            });
+        }
+        ReaderJoiner drain_joiner(drain, *socket);
+
+        wait_for_start(shared, counted);
+
+        int64_t interval_ns = options.rate > 0.0 ? static_cast<int64_t>(1e9 / options.rate) : 0;
+        int64_t next_ns = now_ns();
+        uint64_t sent = 0;
+
+        for (uint32_t sequence = 0; !shared.stop_publishing.load(std::memory_order_relaxed); ++sequence) {
+            MessageStamp stamp{0, static_cast<uint32_t>(index), sequence};
+
+            if (interval_ns > 0) {
+                int64_t now = now_ns();
+                if (next_ns > now) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(next_ns - now));
+                }
+                // In open loop a message that goes out late is still charged from
+                // its scheduled time, which avoids coordinated omission
+                stamp.sent_ns = options.mode == Mode::Open ? next_ns : now_ns();
+                next_ns += interval_ns;
+            } else {
+                stamp.sent_ns = now_ns();
+            }
+
+            stamp_payload(payload, stamp_offset, stamp);
+            send_packet(*socket, tinymq::PacketType::PUB, payload);
+            if (in_window(shared, stamp.sent_ns)) {
+                ++sent;
+            }
+
+            if (options.mode == Mode::Closed) {
+                expect_packet(*socket, tinymq::PacketType::PUBACK);
+            }
+        }
+
+        shared.sent.fetch_add(sent);
+    } catch (const std::exception& e) {
+        std::cerr << "Publisher " << index << ": " << e.what() << std::endl;
+        shared.errors.fetch_add(1);
+        if (!counted) {
+            shared.ready.fetch_add(1);
+        }
+    }
+}
+
+void print_help(const char* program) {
+    std::cout << "TinyMQ Benchmark" << std::endl;
+    std::cout << "Usage: " << program << " [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --host HOST       Broker host (default: 127.0.0.1)" << std::endl;
+    std::cout << "  --port PORT       Broker port (default: 1505)" << std::endl;
+    std::cout << "  --publishers N    Publisher connections, one thread each (default: 1)" << std::endl;
+    std::cout << "  --subscribers M   Subscriber connections, one thread each (default: 1)" << std::endl;
+    std::cout << "  --topics T        Topics the publishers are spread over (default: 1)" << std::endl;
+    std::cout << "  --fanout F        Subscribers per topic (default: all subscribers)" << std::endl;
+    std::cout << "  --size BYTES      Message size, at least " << sizeof(MessageStamp) << " (default: 64)" << std::endl;
+    std::cout << "  --rate R          Messages per second per publisher (default: unlimited)" << std::endl;
+    std::cout << "  --mode MODE       closed (wait for PUBACK) or open (fixed schedule, needs --rate)" << std::endl;
+    std::cout << "  --duration SEC    Measured duration (default: 10)" << std::endl;
+    std::cout << "  --warmup SEC      Unmeasured warmup before the measured window (default: 1)" << std::endl;
+    std::cout << "  --json            Print the report as JSON" << std::endl;
+    std::cout << "  --help            Show this help message" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--publishers" && i + 1 < argc) {
+            options.publishers = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--subscribers" && i + 1 < argc) {
+            options.subscribers = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--topics" && i + 1 < argc) {
+            options.topics = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--fanout" && i + 1 < argc) {
+            options.fanout = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--size" && i + 1 < argc) {
+            options.message_size = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--rate" && i + 1 < argc) {
+            options.rate = std::stod(argv[++i]);
+        } else if (arg == "--mode" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            options.mode = mode == "open" ? Mode::Open : Mode::Closed;
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration = std::stod(argv[++i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            options.warmup = std::stod(argv[++i]);
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--help") {
+            print_help(argv[0]);
+            return 0;
+        }
+    }
+
+    if (options.topics == 0 || options.publishers == 0) {
+        std::cerr << "--topics and --publishers must be at least 1" << std::endl;
+        return 1;
+    }
+    if (options.fanout > options.subscribers) {
+        std::cerr << "--fanout cannot exceed --subscribers" << std::endl;
+        return 1;
+    }
+    if (options.message_size < sizeof(MessageStamp) || options.message_size > 65000) {
+        std::cerr << "--size must be between " << sizeof(MessageStamp) << " and 65000" << std::endl;
+        return 1;
+    }
+    if (options.mode == Mode::Open && options.rate <= 0.0) {
+        std::cerr << "--mode open requires --rate" << std::endl;
+        return 1;
+    }
+
+    Shared shared;
+    std::vector<tcp::socket*> subscriber_sockets;
+    std::mutex sockets_mutex;
+    std::vector<std::thread> subscribers;
+    std::vector<std::thread> publishers;
+
+    for (size_t i = 0; i < options.subscribers; ++i) {
+        subscribers.emplace_back(run_subscriber, std::cref(options), i, std::ref(shared),
+                                 std::ref(subscriber_sockets), std::ref(sockets_mutex));
+    }
+    while (shared.ready.load() < options.subscribers) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    for (size_t i = 0; i < options.publishers; ++i) {
+        publishers.emplace_back(run_publisher, std::cref(options), i, std::ref(shared));
+    }
+    while (shared.ready.load() < options.subscribers + options.publishers) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    int64_t start_ns = now_ns();
+    shared.measure_start_ns = start_ns + static_cast<int64_t>(options.warmup * 1e9);
+    shared.measure_end_ns = shared.measure_start_ns + static_cast<int64_t>(options.duration * 1e9);
+    shared.go.store(true);
+
+    std::this_thread::sleep_for(std::chrono::nanoseconds(shared.measure_end_ns - now_ns()));
+    shared.stop_publishing.store(true);
+    for (auto& publisher : publishers) {
+        publisher.join();
+    }
+
+    // Give in-flight messages a moment to arrive before tearing down subscribers
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    {
+        std::lock_guard<std::mutex> lock(sockets_mutex);
+        for (auto* socket : subscriber_sockets) {
+            shutdown_socket(*socket);
+        }
+    }
+    for (auto& subscriber : subscribers) {
+        subscriber.join();
+    }
+
+    const auto& latency = shared.latency;
+    double seconds = options.duration;
+    double sent_rate = static_cast<double>(shared.sent.load()) / seconds;
+    double recv_rate = static_cast<double>(shared.received.load()) / seconds;
+    double mb_rate = static_cast<double>(shared.received_bytes.load()) / seconds / (1024.0 * 1024.0);
+    auto us = [&latency](double quantile) {
+        return static_cast<double>(latency.percentile(quantile)) / 1000.0;
+    };
+    double mean_us = latency.count > 0 ? static_cast<double>(latency.sum) / latency.count / 1000.0 : 0.0;
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    if (options.json) {
+        out << "{\n"
+            << "  \"mode\": \"" << (options.mode == Mode::Open ? "open" : "closed") << "\",\n"
+            << "  \"publishers\": " << options.publishers << ",\n"
+            << "  \"subscribers\": " << options.subscribers << ",\n"
+            << "  \"topics\": " << options.topics << ",\n"
+            << "  \"message_size\": " << options.message_size << ",\n"
+            << "  \"duration_s\": " << seconds << ",\n"
+            << "  \"sent\": " << shared.sent.load() << ",\n"
+            << "  \"received\": " << shared.received.load() << ",\n"
+            << "  \"sent_msgs_per_s\": " << sent_rate << ",\n"
+            << "  \"recv_msgs_per_s\": " << recv_rate << ",\n"
+            << "  \"recv_mb_per_s\": " << mb_rate << ",\n"
+            << "  \"latency_us\": {\"mean\": " << mean_us << ", \"p50\": " << us(0.5)
+            << ", \"p90\": " << us(0.9) << ", \"p99\": " << us(0.99) << ", \"p999\": " << us(0.999)
+            << ", \"max\": " << us(1.0) << "},\n"
+            << "  \"errors\": " << shared.errors.load() << "\n"
+            << "}\n";
+    } else {
+        out << "Mode:        " << (options.mode == Mode::Open ? "open loop" : "closed loop") << "\n"
+            << "Connections: " << options.publishers << " publishers, " << options.subscribers
+            << " subscribers, " << options.topics << " topics\n"
+            << "Message:     " << options.message_size << " bytes\n"
+            << "Sent:        " << shared.sent.load() << " (" << sent_rate << " msgs/s)\n"
+            << "Received:    " << shared.received.load() << " (" << recv_rate << " msgs/s, "
+            << mb_rate << " MB/s)\n"
+            << "Latency us:  mean " << mean_us << "  p50 " << us(0.5) << "  p90 " << us(0.9)
+            << "  p99 " << us(0.99) << "  p999 " << us(0.999) << "  max " << us(1.0) << "\n";
+        if (shared.errors.load() > 0) {
+            out << "Errors:      " << shared.errors.load() << "\n";
+        }
+    }
+    std::cout << out.str();
+
+    return shared.errors.load() == 0 ? 0 : 1;
+}
@@ -0,0 +1,344 @@
+#include <boost/asio.hpp>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "packet.h"
+
+using boost::asio::ip::tcp;
+using scale_clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+    std::string host = "127.0.0.1";
+    uint16_t port = 1505;
+    size_t connections = 10000;
+    size_t concurrency = 256;               // Handshakes in flight at once
+    size_t per_source = 20000;              // Connections per loopback source address
+    size_t topics = 100;
+    double idle = 10.0;
+    int broker_pid = 0;
+    bool json = false;
+};
+
+struct ProcessSample {
+    long rss_kb = 0;
+    unsigned long long cpu_ticks = 0;
+    bool valid = false;
+};
+
+ProcessSample sample_process(int pid) {
+    ProcessSample sample;
+    if (pid <= 0) {
+        return sample;
+    }
+
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            sample.rss_kb = std::stol(line.substr(6));
+        }
+    }
+
+    // utime and stime are fields 14 and 15; skip past the parenthesised command name
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string content((std::istreambuf_iterator<char>(stat)), std::istreambuf_iterator<char>());
+    auto end = content.rfind(')');
+    if (end != std::string::npos) {
+        std::istringstream fields(content.substr(end + 2));
+        std::string field;
+        unsigned long long utime = 0, stime = 0;
+        for (int i = 3; i <= 15 && fields >> field; ++i) {
+            if (i == 14) {
+                utime = std::stoull(field);
+            } else if (i == 15) {
+                stime = std::stoull(field);
+            }
+        }
+        sample.cpu_ticks = utime + stime;
+        sample.valid = sample.rss_kb > 0;
+    }
+    return sample;
+}
+
+void raise_fd_limit(size_t wanted) {
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < wanted) {
+        limit.rlim_cur = std::min<rlim_t>(limit.rlim_max, wanted);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+class Fleet;
+
+class Connection : public std::enable_shared_from_this<Connection> {
+public:
+    Connection(boost::asio::io_context& io, Fleet& fleet, size_t index)
+        : socket_(io), fleet_(fleet), index_(index) {
+    }
+
+    void start(const tcp::endpoint& source, const tcp::endpoint& broker);
+
+private:
+    void send(tinymq::PacketType type, const std::string& payload, tinymq::PacketType expected,
+              void (Connection::*next)());
+    void subscribe();
+    void established();
+    void fail(const boost::system::error_code& ec);
+
+    tcp::socket socket_;
+    Fleet& fleet_;
+    size_t index_;
+    std::vector<uint8_t> frame_;
+    std::array<uint8_t, 4> header_{};
+    std::vector<uint8_t> payload_;
+};
+
+class Fleet {
+public:
+    Fleet(boost::asio::io_context& io, const Options& options, const tcp::endpoint& broker)
+        : io_(io), options_(options), broker_(broker) {
+        connections_.reserve(options.connections);
+    }
+
+    void start() {
+        for (size_t i = 0; i < options_.concurrency && next_ < options_.connections; ++i) {
+            launch();
+        }
+    }
+
+    void on_established(std::shared_ptr<Connection> connection) {
+        connections_.push_back(std::move(connection));
+        ++established_;
+        launch();
+    }
+
+    void on_failed(const boost::system::error_code& ec) {
+        if (failed_++ < 5) {
+            std::cerr << "Connection failed: " << ec.message() << std::endl;
+        }
+        launch();
+    }
+
+    bool done() const { return established_ + failed_ >= options_.connections; }
+    size_t established() const { return established_; }
+    size_t failed() const { return failed_; }
+    const Options& options() const { return options_; }
+
+private:
+    void launch() {
+        if (next_ >= options_.connections) {
+            return;
+        }
+        size_t index = next_++;
+
+        // Spreading connections over 127.0.0.x keeps each source address under
+        // the ephemeral port range, so the fleet is not capped at ~28k
+        auto address = boost::asio::ip::address_v4(0x7F000001u + static_cast<uint32_t>(index / options_.per_source));
+        std::make_shared<Connection>(io_, *this, index)->start(tcp::endpoint(address, 0), broker_);
+    }
+
+    boost::asio::io_context& io_;
+    const Options& options_;
+    tcp::endpoint broker_;
+    std::vector<std::shared_ptr<Connection>> connections_;
+    size_t next_ = 0;
+    size_t established_ = 0;
+    size_t failed_ = 0;
+};
+
+void Connection::start(const tcp::endpoint& source, const tcp::endpoint& broker) {
+    boost::system::error_code ec;
+    socket_.open(tcp::v4(), ec);
+    if (!ec) {
+        socket_.set_option(tcp::socket::reuse_address(true), ec);
+        socket_.bind(source, ec);
+    }
+    if (ec) {
+        fail(ec);
+        return;
+    }
+
+    auto self = shared_from_this();
+    socket_.async_connect(broker, [this, self](boost::system::error_code ec) {
+        if (ec) {
+            fail(ec);
+            return;
+        }
+        send(tinymq::PacketType::CONN, "scale_" + std::to_string(index_), tinymq::PacketType::CONNACK,
+             &Connection::subscribe);
+    });
+}
+
+void Connection::send(tinymq::PacketType type, const std::string& payload, tinymq::PacketType expected,
+                      void (Connection::*next)()) {
+    frame_ = tinymq::Packet(type, 0, std::vector<uint8_t>(payload.begin(), payload.end())).serialize();
+
+    auto self = shared_from_this();
+    boost::asio::async_write(socket_, boost::asio::buffer(frame_),
+        [this, self, expected, next](boost::system::error_code ec, std::size_t) {
+            if (ec) {
+                fail(ec);
+                return;
+            }
+            boost::asio::async_read(socket_, boost::asio::buffer(header_),
+                [this, self, expected, next](boost::system::error_code ec, std::size_t) {
+                    uint16_t length = (static_cast<uint16_t>(header_[2]) << 8) | header_[3];
+                    if (ec || static_cast<tinymq::PacketType>(header_[0]) != expected || length > 0) {
+                        fail(ec ? ec : boost::asio::error::invalid_argument);
+                        return;
+                    }
+                    (this->*next)();
+                });
+        });
+}
+
+void Connection::subscribe() {
+    if (fleet_.options().topics == 0) {
+        established();
+        return;
+    }
+    send(tinymq::PacketType::SUB, "scale/" + std::to_string(index_ % fleet_.options().topics),
+         tinymq::PacketType::SUBACK, &Connection::established);
+}
+
+void Connection::established() {
+    frame_.clear();
+    frame_.shrink_to_fit();
+    fleet_.on_established(shared_from_this());
+}
+
+void Connection::fail(const boost::system::error_code& ec) {
+    boost::system::error_code ignored;
+    socket_.close(ignored);
+    fleet_.on_failed(ec);
+}
+
+void print_help(const char* program) {
+    std::cout << "TinyMQ Connection Scale Test" << std::endl;
+    std::cout << "Usage: " << program << " --broker-pid PID [options]" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --host HOST         Broker host (default: 127.0.0.1)" << std::endl;
+    std::cout << "  --port PORT         Broker port (default: 1505)" << std::endl;
+    std::cout << "  --connections N     Idle sessions to open (default: 10000)" << std::endl;
+    std::cout << "  --concurrency N     Handshakes in flight at once (default: 256)" << std::endl;
+    std::cout << "  --per-source N      Connections per 127.0.0.x source address (default: 20000)" << std::endl;
+    std::cout << "  --topics N          Distinct topics subscribed across the fleet, 0 to skip SUB (default: 100)" << std::endl;
+    std::cout << "  --idle SEC          Idle period over which broker CPU is measured (default: 10)" << std::endl;
+    std::cout << "  --broker-pid PID    Broker process to sample RSS and CPU from" << std::endl;
+    std::cout << "  --json              Print the report as JSON" << std::endl;
+    std::cout << "  --help              Show this help message" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--host" && i + 1 < argc) {
+            options.host = argv[++i];
+        } else if (arg == "--port" && i + 1 < argc) {
+            options.port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--connections" && i + 1 < argc) {
+            options.connections = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--concurrency" && i + 1 < argc) {
+            options.concurrency = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--per-source" && i + 1 < argc) {
+            options.per_source = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--topics" && i + 1 < argc) {
+            options.topics = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--idle" && i + 1 < argc) {
+            options.idle = std::stod(argv[++i]);
+        } else if (arg == "--broker-pid" && i + 1 < argc) {
+            options.broker_pid = std::stoi(argv[++i]);
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--help") {
+            print_help(argv[0]);
+            return 0;
+        }
+    }
+
+    if (options.concurrency == 0 || options.per_source == 0) {
+        std::cerr << "--concurrency and --per-source must be at least 1" << std::endl;
+        return 1;
+    }
+    if (options.broker_pid <= 0) {
+        std::cerr << "Warning: no --broker-pid given, broker RSS and CPU will not be reported" << std::endl;
+    }
+
+    raise_fd_limit(options.connections + 64);
+
+    boost::asio::io_context io;
+    tcp::resolver resolver(io);
+    tcp::endpoint broker = *resolver.resolve(options.host, std::to_string(options.port)).begin();
+
+    auto before = sample_process(options.broker_pid);
+
+    Fleet fleet(io, options, broker);
+    auto start = scale_clock::now();
+    fleet.start();
+    while (!fleet.done()) {
+        io.run_one();
+    }
+    std::chrono::duration<double> establish_time = scale_clock::now() - start;
+
+    // Let the broker finish logging and settle before sampling its footprint
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    auto established = sample_process(options.broker_pid);
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.idle));
+    auto idle = sample_process(options.broker_pid);
+
+    size_t count = fleet.established();
+    double rss_per_session = 0.0;
+    double idle_cpu = 0.0;
+    bool have_broker = before.valid && established.valid && idle.valid;
+    if (have_broker && count > 0) {
+        rss_per_session = static_cast<double>(established.rss_kb - before.rss_kb) * 1024.0 / count;
+        double ticks = static_cast<double>(idle.cpu_ticks - established.cpu_ticks);
+        idle_cpu = 100.0 * ticks / static_cast<double>(sysconf(_SC_CLK_TCK)) / options.idle;
+    }
+
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(2);
+    if (options.json) {
+        out << "{\n"
+            << "  \"requested\": " << options.connections << ",\n"
+            << "  \"established\": " << count << ",\n"
+            << "  \"failed\": " << fleet.failed() << ",\n"
+            << "  \"establish_seconds\": " << establish_time.count() << ",\n"
+            << "  \"connections_per_second\": " << count / establish_time.count();
+        if (have_broker) {
+            out << ",\n"
+                << "  \"broker_rss_before_kb\": " << before.rss_kb << ",\n"
+                << "  \"broker_rss_after_kb\": " << established.rss_kb << ",\n"
+                << "  \"broker_rss_per_session_bytes\": " << rss_per_session << ",\n"
+                << "  \"broker_idle_cpu_percent\": " << idle_cpu;
+        }
+        out << "\n}\n";
+    } else {
+        out << "Sessions:     " << count << " established, " << fleet.failed() << " failed\n"
+            << "Establish:    " << establish_time.count() << " s (" << count / establish_time.count()
+            << " sessions/s)\n";
+        if (have_broker) {
+            out << "Broker RSS:   " << before.rss_kb << " kB -> " << established.rss_kb << " kB ("
+                << rss_per_session << " bytes/session)\n"
+                << "Broker CPU:   " << idle_cpu << "% over " << options.idle << " s idle\n";
+        }
+    }
+    std::cout << out.str();
+
+    return fleet.failed() == 0 ? 0 : 1;
+}
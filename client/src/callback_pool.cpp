@@ -0,0 +1,82 @@
+#include "callback_pool.h"
+#include "terminal_ui.h"
+#include <string>
+
+namespace tinymq {
+namespace client {
+
+CallbackPool::CallbackPool(size_t workers, size_t queue_capacity, std::function<void()> on_space)
+    : queue_capacity_(queue_capacity > 0 ? queue_capacity : 1),
+      on_space_(std::move(on_space)) {
+    workers_.reserve(workers);
+    for (size_t i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (auto& worker : workers_) {
+        worker->thread = std::thread([this, &worker = *worker]() { run(worker); });
+    }
+}
+
+CallbackPool::~CallbackPool() {
+    // Queued tasks still run before the workers exit
+    for (auto& worker : workers_) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        stopping_ = true;
+        worker->cv.notify_one();
+    }
+    for (auto& worker : workers_) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
+
+bool CallbackPool::post(size_t key, Task task) {
+    Worker& worker = *workers_[key % workers_.size()];
+    bool has_room;
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        has_room = worker.tasks.size() < queue_capacity_;
+        if (!has_room) {
+            worker.full = true;
+        }
+    }
+    worker.cv.notify_one();
+    return has_room;
+}
+
+void CallbackPool::run(Worker& worker) {
+    while (true) {
+        Task task;
+        bool drained = false;
+        {
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.cv.wait(lock, [this, &worker]() {
+                return stopping_ || !worker.tasks.empty();
+            });
+            if (worker.tasks.empty()) {
+                return;
+            }
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+            if (worker.full && worker.tasks.size() <= queue_capacity_ / 2) {
+                worker.full = false;
+                drained = true;
+            }
+        }
+
+        if (drained && on_space_) {
+            on_space_();
+        }
+
+        try {
+            task();
+        } catch (const std::exception& e) {
+            ui::print_message("Client", "Callback exception: " + std::string(e.what()), ui::MessageType::ERROR);
+        }
+    }
+}
+
+} // namespace client
+} // namespace tinymq
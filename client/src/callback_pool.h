@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tinymq {
+namespace client {
+
+// Fixed set of worker threads, each with its own bounded FIFO. Tasks posted
+// with the same key always run on the same worker, in order.
+class CallbackPool {
+public:
+    using Task = std::function<void()>;
+
+    // on_space is called from a worker once a full queue has drained to half
+    // its capacity
+    CallbackPool(size_t workers, size_t queue_capacity, std::function<void()> on_space);
+    ~CallbackPool();
+
+    CallbackPool(const CallbackPool&) = delete;
+    CallbackPool& operator=(const CallbackPool&) = delete;
+
+    // Always queues the task; returns false if the worker's queue is now
+    // full, in which case the caller should hold off until on_space
+    bool post(size_t key, Task task);
+
+    size_t workers() const { return workers_.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<Task> tasks;
+        bool full = false;
+        std::thread thread;
+    };
+
+    void run(Worker& worker);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    size_t queue_capacity_;
+    std::function<void()> on_space_;
+    std::atomic<bool> stopping_{false};
+};
+
+} // namespace client
+} // namespace tinymq
@@ -1,20 +1,64 @@
 #include "client.h"
 #include "terminal_ui.h"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <iostream>
 
 namespace tinymq {
 namespace client {
 
+namespace {
+
+// Hosts of the form "unix:/path" connect to a Unix domain socket and
+// "shm:/path" set up a shared memory channel through one; the port is ignored
+constexpr std::string_view unix_prefix = "unix:";
+constexpr std::string_view shm_prefix = "shm:";
+
+} // namespace
+
 Client::Client(const std::string& client_id, const std::string& host, uint16_t port)
     : client_id_(client_id),
       host_(host),
       port_(port),
-      read_buffer_(1024) {
+      owned_io_context_(std::make_unique<boost::asio::io_context>()),
+      io_context_(*owned_io_context_),
+      external_io_(false),
+      strand_(io_context_.get_executor()),
+      resolver_(io_context_),
+      connect_timer_(io_context_),
+      read_buffer_(1024),
+      linger_timer_(io_context_),
+      reconnect_timer_(io_context_),
+      reconnect_random_(static_cast<std::minstd_rand::result_type>(
+          std::random_device{}() ^ std::hash<std::string>{}(client_id))) {
+}
+
+Client::Client(boost::asio::io_context& io_context, const std::string& client_id,
+               const std::string& host, uint16_t port)
+    : client_id_(client_id),
+      host_(host),
+      port_(port),
+      io_context_(io_context),
+      external_io_(true),
+      strand_(io_context_.get_executor()),
+      resolver_(io_context_),
+      connect_timer_(io_context_),
+      read_buffer_(1024),
+      linger_timer_(io_context_),
+      reconnect_timer_(io_context_),
+      reconnect_random_(static_cast<std::minstd_rand::result_type>(
+          std::random_device{}() ^ std::hash<std::string>{}(client_id))) {
 }
 
 Client::~Client() {
     disconnect();
+    if (callback_pool_) {
+        // Runs the callbacks still queued before the workers exit, then
+        // drains any read resumption they posted
+        callback_pool_.reset();
+        stop_io();
+    }
 }
 
 bool Client::connect() {
@@ -22,88 +66,298 @@ bool Client::connect() {
         ui::print_message("Client", "Already connected", ui::MessageType::INFO);
         return true;
     }
+    
+    if (on_io_thread()) {
+        ui::print_message("Client", "connect() cannot block inside a client callback; use async_connect()", 
+                        ui::MessageType::ERROR);
+        return false;
+    }
 
-    try {
-        ui::print_message("Client", "Connecting to " + host_ + ":" + std::to_string(port_) + 
-                         " as '" + client_id_ + "'", ui::MessageType::INFO);
-        
-        socket_ = std::make_unique<boost::asio::ip::tcp::socket>(io_context_);
+    auto done = std::make_shared<std::promise<bool>>();
+    auto connected = done->get_future();
+    async_connect([done](bool ok) {
+        done->set_value(ok);
+    });
 
-        boost::asio::ip::tcp::resolver resolver(io_context_);
-        auto endpoints = resolver.resolve(host_, std::to_string(port_));
+    return wait_for(connected);
+}
 
-        boost::asio::connect(*socket_, endpoints);
+void Client::async_connect(ConnectCallback callback) {
+    if (connected_) {
+        if (callback) {
+            callback(true);
+        }
+        return;
+    }
 
-        std::vector<uint8_t> payload(client_id_.begin(), client_id_.end());
-        Packet connect_packet(PacketType::CONN, 0, payload);
+    // A previous attempt or a lost connection may have left the io thread
+    // running; restart it cleanly unless we are being called from it
+    if (!on_io_thread()) {
+        stop_io();
+    }
 
-        if (!send_packet(connect_packet)) {
-            ui::print_message("Client", "Failed to send CONNECT packet", ui::MessageType::ERROR);
-            socket_->close();
-            return false;
-        }
+    boost::asio::post(track([this, callback = std::move(callback)]() mutable {
+        begin_connect(std::move(callback));
+    }));
 
-        io_thread_ = std::thread([this]() {
-            try {
-                start_read();
-                io_context_.run();
-            } catch (const std::exception& e) {
-                ui::print_message("Client", "IO thread exception: " + std::string(e.what()), 
-                                ui::MessageType::ERROR);
-            }
-        });
+    if (!io_thread_.joinable()) {
+        start_io();
+    }
+}
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+void Client::set_connect_timeout(std::chrono::milliseconds timeout) {
+    connect_timeout_ = timeout;
+}
 
-        return connected_;
-    } catch (const std::exception& e) {
-        ui::print_message("Client", "Connection error: " + std::string(e.what()), ui::MessageType::ERROR);
-        return false;
+void Client::set_reconnect_policy(const ReconnectPolicy& policy) {
+    reconnect_policy_ = policy;
+}
+
+void Client::set_write_linger(std::chrono::milliseconds linger, size_t max_batch) {
+    write_linger_ = linger;
+    max_write_batch_ = max_batch > 0 ? max_batch : 1;
+}
+
+void Client::set_callback_workers(size_t workers, size_t queue_capacity) {
+    callback_pool_.reset();
+    if (workers > 0) {
+        callback_pool_ = std::make_unique<CallbackPool>(workers, queue_capacity, [this]() {
+            resume_reading();
+        });
     }
 }
 
-void Client::disconnect() {
-    if (!connected_) {
+void Client::start_io() {
+    if (external_io_) {
         return;
     }
+    
+    // Keeps the io thread alive after a connection loss so that queued
+    // operations still complete (with an error) until disconnect()
+    work_guard_.emplace(io_context_.get_executor());
+    
+    io_thread_ = std::thread([this]() {
+        try {
+            io_context_.run();
+        } catch (const std::exception& e) {
+            ui::print_message("Client", "IO thread exception: " + std::string(e.what()), 
+                            ui::MessageType::ERROR);
+        }
+    });
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
+void Client::stop_io() {
+    if (external_io_) {
+        connect_timer_.cancel();
+        linger_timer_.cancel();
+        reconnect_timer_.cancel();
+        resolver_.cancel();
+        close_stream();
+        
+        // Handlers still queued on the shared context refer to this client
+        if (!on_io_thread()) {
+            run_until([this]() { return pending_ops_ == 0; });
+        }
+        return;
+    }
     
-    connected_ = false;
+    work_guard_.reset();
+    io_context_.stop();
 
-    ui::print_message("Client", "Disconnecting...", ui::MessageType::INFO);
+    if (io_thread_.joinable()) {
+        io_thread_.join();
+    }
+
+    connect_timer_.cancel();
+    linger_timer_.cancel();
+    reconnect_timer_.cancel();
+    resolver_.cancel();
+    close_stream();
+
+    // Run whatever was queued after the io thread stopped; with the socket
+    // closed every pending operation completes with an error
+    io_context_.restart();
+    io_context_.poll();
+    io_context_.restart();
+}
+
+void Client::begin_connect(ConnectCallback callback) {
+    bool shm = host_.compare(0, shm_prefix.size(), shm_prefix) == 0;
+    bool local = shm || host_.compare(0, unix_prefix.size(), unix_prefix) == 0;
+    ui::print_message("Client", "Connecting to " + (local ? host_ : host_ + ":" + std::to_string(port_)) + 
+                     " as '" + client_id_ + "'", ui::MessageType::INFO);
+    
+    connect_callback_ = std::move(callback);
+    ++connection_id_;
+    read_paused_ = false;
+    socket_ = std::make_unique<boost::asio::generic::stream_protocol::socket>(io_context_);
+    if (shm_) {
+        shm_->close();
+        shm_.reset();
+    }
     
+    connect_timer_.expires_after(connect_timeout_);
+    connect_timer_.async_wait(track([this](boost::system::error_code ec) {
+        if (!ec && connect_callback_) {
+            ui::print_message("Client", "Timed out waiting for connection acknowledgement", 
+                            ui::MessageType::ERROR);
+            resolver_.cancel();
+            close_stream();
+            complete_connect(false);
+        }
+    }));
+
+    if (shm) {
+        // Setting up the channel is a local handshake that does not block
+        boost::asio::post(io_context_, track([this, id = connection_id_]() {
+            if (id != connection_id_) {
+                return;
+            }
+            boost::system::error_code ec;
+            shm_ = ShmChannel::connect(io_context_, host_.substr(shm_prefix.size()),
+                                       ShmChannel::default_ring_capacity, ec);
+            if (!shm_) {
+                connect_failed(ec);
+                return;
+            }
+            send_connect();
+        }));
+        return;
+    }
+
+    if (local) {
+        boost::asio::local::stream_protocol::endpoint endpoint(host_.substr(unix_prefix.size()));
+        socket_->async_connect(endpoint, track([this](boost::system::error_code ec) {
+            if (ec) {
+                connect_failed(ec);
+                return;
+            }
+            send_connect();
+        }));
+        return;
+    }
+
+    resolver_.async_resolve(host_, std::to_string(port_),
+        track([this](boost::system::error_code ec,
+                     boost::asio::ip::tcp::resolver::results_type results) {
+            if (ec) {
+                connect_failed(ec);
+                return;
+            }
+            
+            std::vector<boost::asio::generic::stream_protocol::endpoint> endpoints;
+            for (const auto& result : results) {
+                endpoints.emplace_back(result.endpoint());
+            }
+            boost::asio::async_connect(*socket_, endpoints,
+                track([this](boost::system::error_code ec,
+                             const boost::asio::generic::stream_protocol::endpoint&) {
+                    if (ec) {
+                        connect_failed(ec);
+                        return;
+                    }
+                    
+                    boost::system::error_code option_ec;
+                    socket_->set_option(boost::asio::ip::tcp::no_delay(true), option_ec);
+                    send_connect();
+                }));
+        }));
+}
+
+void Client::send_connect() {
+    std::vector<uint8_t> payload(client_id_.begin(), client_id_.end());
+    queue_frame(std::make_shared<const std::vector<uint8_t>>(
+        Packet(PacketType::CONN, 0, payload).serialize()), nullptr);
+    start_read();
+}
+
+bool Client::stream_open() const {
+    return shm_ ? shm_->is_open() : socket_ && socket_->is_open();
+}
+
+void Client::close_stream() {
+    if (shm_) {
+        shm_->close();
+    }
     if (socket_ && socket_->is_open()) {
         boost::system::error_code ec;
         socket_->close(ec);
     }
+}
 
-    io_context_.stop();
+void Client::connect_failed(const boost::system::error_code& ec) {
+    if (!connect_callback_) {
+        return;
+    }
+    if (ec != boost::asio::error::operation_aborted) {
+        ui::print_message("Client", "Connection error: " + ec.message(), ui::MessageType::ERROR);
+    }
+    connect_timer_.cancel();
+    complete_connect(false);
+}
 
-    if (io_thread_.joinable()) {
-        io_thread_.join();
+void Client::complete_connect(bool connected) {
+    ConnectCallback callback = std::move(connect_callback_);
+    connect_callback_ = nullptr;
+    if (callback) {
+        callback(connected);
+    }
+}
+
+void Client::disconnect() {
+    if (!connected_ && !reconnecting_ && !io_active()) {
+        return;
     }
 
+    connected_ = false;
+    reconnecting_ = false;
+
+    ui::print_message("Client", "Disconnecting...", ui::MessageType::INFO);
+    
+    stop_io();
+    fail_inflight();
+    complete_connect(false);
+
     topic_handlers_.clear();
+    subscriptions_.clear();
     
     ui::print_message("Client", "Disconnected", ui::MessageType::SUCCESS);
 }
 
 bool Client::subscribe(const std::string& topic, const MessageCallback& callback) {
+    return add_subscription(topic, {callback, nullptr});
+}
+
+bool Client::subscribe(const std::string& topic, MessageViewCallback callback) {
+    return add_subscription(topic, {nullptr, std::move(callback)});
+}
+
+bool Client::subscribe(const std::string& topic) {
+    return add_subscription(topic, {nullptr, nullptr});
+}
+
+bool Client::add_subscription(const std::string& topic, TopicHandler handler) {
     if (!connected_) {
         ui::print_message("Client", "Not connected", ui::MessageType::ERROR);
         return false;
     }
+    
+    if (!TopicRouter<TopicHandler>::is_valid_filter(topic)) {
+        ui::print_message("Client", "Invalid topic filter: " + topic, ui::MessageType::ERROR);
+        return false;
+    }
 
     ui::print_message("Client", "Subscribing to topic: " + topic, ui::MessageType::INFO);
     
     std::vector<uint8_t> payload(topic.begin(), topic.end());
     Packet sub_packet(PacketType::SUB, 0, payload);
 
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        topic_handlers_[topic] = callback;
-    }
+    boost::asio::post(track([this, topic, handler = std::move(handler)]() mutable {
+        subscriptions_.insert(topic);
+        if (handler.callback || handler.view_callback) {
+            topic_handlers_.insert(topic, std::move(handler));
+        }
+    }));
 
     if (!send_packet(sub_packet)) {
         ui::print_message("Client", "Failed to send SUB packet for topic: " + topic, ui::MessageType::ERROR);
@@ -113,6 +367,32 @@ bool Client::subscribe(const std::string& topic, const MessageCallback& callback
     return true;
 }
 
+bool Client::add_handler(const std::string& filter, const MessageCallback& callback) {
+    return install_handler(filter, {callback, nullptr});
+}
+
+bool Client::add_handler(const std::string& filter, MessageViewCallback callback) {
+    return install_handler(filter, {nullptr, std::move(callback)});
+}
+
+bool Client::install_handler(const std::string& filter, TopicHandler handler) {
+    if (!TopicRouter<TopicHandler>::is_valid_filter(filter)) {
+        ui::print_message("Client", "Invalid topic filter: " + filter, ui::MessageType::ERROR);
+        return false;
+    }
+    
+    boost::asio::post(track([this, filter, handler = std::move(handler)]() mutable {
+        topic_handlers_.insert(filter, std::move(handler));
+    }));
+    return true;
+}
+
+void Client::remove_handler(const std::string& filter) {
+    boost::asio::post(track([this, filter]() {
+        topic_handlers_.erase(filter);
+    }));
+}
+
 bool Client::unsubscribe(const std::string& topic) {
     if (!connected_) {
         ui::print_message("Client", "Not connected", ui::MessageType::ERROR);
@@ -124,10 +404,10 @@ bool Client::unsubscribe(const std::string& topic) {
     std::vector<uint8_t> payload(topic.begin(), topic.end());
     Packet unsub_packet(PacketType::UNSUB, 0, payload);
 
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
+    boost::asio::post(track([this, topic]() {
+        subscriptions_.erase(topic);
         topic_handlers_.erase(topic);
-    }
+    }));
 
     if (!send_packet(unsub_packet)) {
         ui::print_message("Client", "Failed to send UNSUB packet for topic: " + topic, ui::MessageType::ERROR);
@@ -158,17 +438,13 @@ bool Client::publish(const std::string& topic, const std::vector<uint8_t>& messa
     
     ui::print_message("Client", "Publishing to topic '" + topic + "': " + msg_preview, ui::MessageType::OUTGOING);
     
-    std::vector<uint8_t> payload;
-    
-    payload.push_back(static_cast<uint8_t>(topic.size()));
-    
-    payload.insert(payload.end(), topic.begin(), topic.end());
-    
-    payload.insert(payload.end(), message.begin(), message.end());
-    
-    Packet pub_packet(PacketType::PUB, 0, payload);
+    Frame frame = build_publish_frame(topic, message);
+    if (!frame) {
+        ui::print_message("Client", "Empty or oversized message for topic: " + topic, ui::MessageType::ERROR);
+        return false;
+    }
     
-    if (!send_packet(pub_packet)) {
+    if (!send_frame(std::move(frame), true)) {
         ui::print_message("Client", "Failed to publish to topic: " + topic, ui::MessageType::ERROR);
         return false;
     }
@@ -181,7 +457,58 @@ bool Client::publish(const std::string& topic, const std::string& message) {
     return publish(topic, message_bytes);
 }
 
+void Client::async_publish(const std::string& topic, const std::vector<uint8_t>& message,
+                           PublishCallback callback) {
+    Frame frame = build_publish_frame(topic, message);
+    if (!frame || !accepting_publishes() || !acquire_window()) {
+        if (callback) {
+            callback(false);
+        }
+        return;
+    }
+    
+    boost::asio::post(track([this, frame = std::move(frame), callback = std::move(callback)]() mutable {
+        if (!accepting_publishes()) {
+            release_window();
+            if (callback) {
+                callback(false);
+            }
+            return;
+        }
+        
+        inflight_.push_back({frame, std::move(callback), true});
+        if (connected_) {
+            queue_frame(std::move(frame), nullptr, true);
+        } else {
+            // Held for replay after reconnecting; keep only the newest
+            fail_inflight(reconnect_policy_.replay_buffer);
+        }
+    }));
+}
+
+std::future<bool> Client::async_publish(const std::string& topic, const std::vector<uint8_t>& message) {
+    auto done = std::make_shared<std::promise<bool>>();
+    auto result = done->get_future();
+    async_publish(topic, message, [done](bool acknowledged) {
+        done->set_value(acknowledged);
+    });
+    return result;
+}
+
+std::future<bool> Client::async_publish(const std::string& topic, const std::string& message) {
+    return async_publish(topic, std::vector<uint8_t>(message.begin(), message.end()));
+}
+
+void Client::set_max_inflight(size_t max_inflight) {
+    std::lock_guard<std::mutex> lock(window_mutex_);
+    max_inflight_ = max_inflight > 0 ? max_inflight : 1;
+    window_cv_.notify_all();
+}
+
 void Client::poll() {
+    if (io_context_.stopped()) {
+        io_context_.restart();
+    }
     io_context_.poll();
 }
 
@@ -190,37 +517,42 @@ void Client::start_read() {
 }
 
 void Client::read_header() {
-    if (!socket_ || !socket_->is_open()) {
+    if (!stream_open()) {
         return;
     }
 
-    boost::asio::async_read(
-        *socket_,
-        boost::asio::buffer(read_buffer_.data(), header_length),
-        [this](boost::system::error_code ec, std::size_t length) {
-            if (!ec && length == header_length) {
-                PacketHeader header;
-                header.type = static_cast<PacketType>(read_buffer_[0]);
-                header.flags = read_buffer_[1];
-                header.payload_length = (static_cast<uint16_t>(read_buffer_[2]) << 8) | read_buffer_[3];
-                
-                if (header.payload_length > 0) {
-                    read_payload(header);
-                } else {
-                    Packet packet(header.type, header.flags, {});
-                    process_packet(packet);
+    with_stream([&](auto& stream) {
+        boost::asio::async_read(
+            stream,
+            boost::asio::buffer(read_buffer_.data(), header_length),
+            track([this, id = connection_id_](boost::system::error_code ec, std::size_t length) {
+                if (id != connection_id_) {
+                    return;
                 }
-            } else {
-                if (ec != boost::asio::error::eof && ec != boost::asio::error::operation_aborted) {
-                    ui::print_message("Client", "Read header error: " + ec.message(), ui::MessageType::ERROR);
+                if (!ec && length == header_length) {
+                    PacketHeader header;
+                    header.type = static_cast<PacketType>(read_buffer_[0]);
+                    header.flags = read_buffer_[1];
+                    header.payload_length = (static_cast<uint16_t>(read_buffer_[2]) << 8) | read_buffer_[3];
+                    
+                    if (header.payload_length > 0) {
+                        read_payload(header);
+                    } else {
+                        Packet packet(header.type, header.flags, {});
+                        process_packet(packet);
+                    }
+                } else {
+                    if (ec != boost::asio::error::eof && ec != boost::asio::error::operation_aborted) {
+                        ui::print_message("Client", "Read header error: " + ec.message(), ui::MessageType::ERROR);
+                    }
+                    connection_lost();
                 }
-                disconnect();
-            }
-        });
+            }));
+    });
 }
 
 void Client::read_payload(PacketHeader header) {
-    if (!socket_ || !socket_->is_open()) {
+    if (!stream_open()) {
         return;
     }
 
@@ -228,22 +560,37 @@ void Client::read_payload(PacketHeader header) {
         read_buffer_.resize(header.payload_length);
     }
     
-    boost::asio::async_read(
-        *socket_,
-        boost::asio::buffer(read_buffer_.data(), header.payload_length),
-        [this, header](boost::system::error_code ec, std::size_t length) {
-            if (!ec && length == header.payload_length) {
-                std::vector<uint8_t> payload(read_buffer_.begin(), read_buffer_.begin() + length);
-                Packet packet(header.type, header.flags, payload);
-                
-                process_packet(packet);
-            } else {
-                if (ec != boost::asio::error::eof && ec != boost::asio::error::operation_aborted) {
-                    ui::print_message("Client", "Read payload error: " + ec.message(), ui::MessageType::ERROR);
+    with_stream([&](auto& stream) {
+        boost::asio::async_read(
+            stream,
+            boost::asio::buffer(read_buffer_.data(), header.payload_length),
+            track([this, header, id = connection_id_](boost::system::error_code ec,
+                                                      std::size_t length) {
+                if (id != connection_id_) {
+                    return;
                 }
-                disconnect();
-            }
-        });
+                if (!ec && length == header.payload_length) {
+                    // Publishes are delivered straight from the read buffer
+                    if (header.type == PacketType::PUB) {
+                        handle_publish(read_buffer_.data(), length);
+                        if (!read_paused_) {
+                            read_header();
+                        }
+                        return;
+                    }
+                    
+                    std::vector<uint8_t> payload(read_buffer_.begin(), read_buffer_.begin() + length);
+                    Packet packet(header.type, header.flags, payload);
+                    
+                    process_packet(packet);
+                } else {
+                    if (ec != boost::asio::error::eof && ec != boost::asio::error::operation_aborted) {
+                        ui::print_message("Client", "Read payload error: " + ec.message(), ui::MessageType::ERROR);
+                    }
+                    connection_lost();
+                }
+            }));
+    });
 }
 
 void Client::process_packet(const Packet& packet) {
@@ -265,7 +612,7 @@ void Client::process_packet(const Packet& packet) {
             break;
             
         case PacketType::PUB:
-            handle_publish(packet);
+            handle_publish(packet.payload().data(), packet.payload().size());
             break;
             
         default:
@@ -280,10 +627,29 @@ void Client::process_packet(const Packet& packet) {
 void Client::handle_connack(const Packet& packet) {
     ui::print_message("Client", "Connection acknowledged", ui::MessageType::SUCCESS);
     connected_ = true;
+    connect_timer_.cancel();
+    restore_session();
+    complete_connect(true);
 }
 
 void Client::handle_puback(const Packet& packet) {
-    ui::print_message("Client", "Publish acknowledged", ui::MessageType::SUCCESS);
+    if (inflight_.empty()) {
+        ui::print_message("Client", "Unexpected publish acknowledgement", ui::MessageType::WARNING);
+        return;
+    }
+    
+    InflightPublish acknowledged = std::move(inflight_.front());
+    inflight_.pop_front();
+    
+    if (acknowledged.windowed) {
+        release_window();
+    } else {
+        ui::print_message("Client", "Publish acknowledged", ui::MessageType::SUCCESS);
+    }
+    
+    if (acknowledged.callback) {
+        acknowledged.callback(true);
+    }
 }
 
 void Client::handle_suback(const Packet& packet) {
@@ -294,63 +660,403 @@ void Client::handle_unsuback(const Packet& packet) {
     ui::print_message("Client", "Unsubscribe acknowledged", ui::MessageType::SUCCESS);
 }
 
-void Client::handle_publish(const Packet& packet) {
-    const auto& payload = packet.payload();
+void Client::handle_publish(const uint8_t* payload, size_t size) {
+    if (size < 2 || size <= static_cast<size_t>(payload[0]) + 1) {
+        return;
+    }
     
-    if (payload.size() > 1) {
-        uint8_t topic_length = payload[0];
-        
-        if (payload.size() > topic_length + 1) {
-            std::string topic(payload.begin() + 1, payload.begin() + 1 + topic_length);
-            std::vector<uint8_t> message(payload.begin() + 1 + topic_length, payload.end());
-            
-            std::string msg_preview;
-            for (size_t i = 0; i < std::min(message.size(), size_t(20)); ++i) {
-                char c = static_cast<char>(message[i]);
-                if (isprint(c)) {
-                    msg_preview += c;
-                } else {
-                    msg_preview += '?';
-                }
-            }
-            if (message.size() > 20) {
-                msg_preview += "...";
-            }
-            
-            ui::print_message("Client", "Received message on topic '" + topic + "': " + msg_preview, 
-                            ui::MessageType::INCOMING);
-            
-            MessageCallback callback = nullptr;
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-                auto it = topic_handlers_.find(topic);
-                if (it != topic_handlers_.end()) {
-                    callback = it->second;
-                }
-            }
-            
-            // Call the handler if registered
-            if (callback) {
-                callback(topic, message);
-            }
+    uint8_t topic_length = payload[0];
+    std::string_view topic(reinterpret_cast<const char*>(payload + 1), topic_length);
+    ByteSpan message{payload + 1 + topic_length, size - 1 - topic_length};
+    
+    // Handlers are only modified on strand_, so the lookup needs no lock;
+    // wildcard resolutions are cached per topic by the router
+    const TopicHandler* handler = topic_handlers_.match(topic);
+    if (handler && handler->view_callback) {
+        if (callback_pool_) {
+            // The read buffer is reused once this returns, so the worker
+            // gets its own copy
+            dispatch_callback(topic, [callback = handler->view_callback, topic = std::string(topic),
+                                      bytes = std::vector<uint8_t>(message.begin(), message.end())]() {
+                callback(topic, ByteSpan{bytes.data(), bytes.size()});
+            });
+        } else {
+            handler->view_callback(topic, message);
         }
+        return;
     }
+    
+    std::string msg_preview;
+    for (size_t i = 0; i < std::min(message.size, size_t(20)); ++i) {
+        char c = static_cast<char>(message.data[i]);
+        if (isprint(c)) {
+            msg_preview += c;
+        } else {
+            msg_preview += '?';
+        }
+    }
+    if (message.size > 20) {
+        msg_preview += "...";
+    }
+    
+    std::string topic_name(topic);
+    ui::print_message("Client", "Received message on topic '" + topic_name + "': " + msg_preview, 
+                    ui::MessageType::INCOMING);
+    
+    // Call the handler if registered
+    if (handler && handler->callback) {
+        std::vector<uint8_t> message_bytes(message.begin(), message.end());
+        if (callback_pool_) {
+            dispatch_callback(topic, [callback = handler->callback, topic_name = std::move(topic_name),
+                                      message_bytes = std::move(message_bytes)]() {
+                callback(topic_name, message_bytes);
+            });
+        } else {
+            handler->callback(topic_name, message_bytes);
+        }
+    }
+}
+
+void Client::dispatch_callback(std::string_view topic, CallbackPool::Task task) {
+    // Hashing the topic keeps each topic's messages in order on one worker
+    if (!callback_pool_->post(std::hash<std::string_view>{}(topic), std::move(task))) {
+        // Stop reading until the worker catches up; TCP flow control then
+        // pushes back on the broker instead of the queue growing
+        read_paused_ = true;
+    }
+}
+
+void Client::resume_reading() {
+    boost::asio::post(track([this]() {
+        if (read_paused_) {
+            read_paused_ = false;
+            read_header();
+        }
+    }));
 }
 
 bool Client::send_packet(const Packet& packet) {
-    if (!socket_ || !socket_->is_open()) {
+    return send_frame(std::make_shared<const std::vector<uint8_t>>(packet.serialize()), false);
+}
+
+bool Client::send_frame(Frame frame, bool expect_puback) {
+    if (!stream_open()) {
         return false;
     }
 
-    try {
-        auto serialized = packet.serialize();
-        boost::asio::write(*socket_, boost::asio::buffer(serialized));
+    // From inside the io context the frame can only be queued; it is
+    // written once the current handler returns
+    if (on_io_thread() || (!external_io_ && !io_thread_.joinable())) {
+        boost::asio::post(track([this, frame = std::move(frame), expect_puback]() mutable {
+            if (expect_puback) {
+                inflight_.push_back({frame, nullptr, false});
+            }
+            queue_frame(std::move(frame), nullptr);
+        }));
         return true;
-    } catch (const std::exception& e) {
-        ui::print_message("Client", "Send error: " + std::string(e.what()), ui::MessageType::ERROR);
+    }
+
+    auto done = std::make_shared<std::promise<bool>>();
+    auto written = done->get_future();
+    boost::asio::post(track([this, frame = std::move(frame), expect_puback, done]() mutable {
+        if (expect_puback) {
+            inflight_.push_back({frame, nullptr, false});
+        }
+        queue_frame(std::move(frame), [done](bool ok) {
+            done->set_value(ok);
+        });
+    }));
+
+    return wait_for(written);
+}
+
+bool Client::on_io_thread() const {
+    if (external_io_) {
+        return io_context_.get_executor().running_in_this_thread();
+    }
+    return io_thread_.get_id() == std::this_thread::get_id();
+}
+
+bool Client::io_active() const {
+    return external_io_ ? pending_ops_ > 0 : io_thread_.joinable();
+}
+
+bool Client::wait_for(std::future<bool>& result) {
+    try {
+        if (external_io_) {
+            run_until([&result]() {
+                return result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+            });
+        }
+        return result.get();
+    } catch (const std::future_error&) {
+        return false;
+    }
+}
+
+Client::Frame Client::build_publish_frame(const std::string& topic, const std::vector<uint8_t>& message) {
+    // The broker acks neither an empty message nor an oversized one, and an
+    // unacked PUB would shift every later PUBACK onto the wrong publish
+    if (message.empty() || topic.size() > 255 || 1 + topic.size() + message.size() > 0xFFFF) {
+        return nullptr;
+    }
+    
+    auto frame = std::make_shared<std::vector<uint8_t>>();
+    frame->reserve(header_length + 1 + topic.size() + message.size());
+    
+    uint16_t payload_length = static_cast<uint16_t>(1 + topic.size() + message.size());
+    frame->push_back(static_cast<uint8_t>(PacketType::PUB));
+    frame->push_back(0);
+    frame->push_back(static_cast<uint8_t>(payload_length >> 8));
+    frame->push_back(static_cast<uint8_t>(payload_length & 0xFF));
+    
+    frame->push_back(static_cast<uint8_t>(topic.size()));
+    frame->insert(frame->end(), topic.begin(), topic.end());
+    frame->insert(frame->end(), message.begin(), message.end());
+    
+    return frame;
+}
+
+void Client::queue_frame(Frame frame, WriteCallback on_written, bool may_linger) {
+    outbox_.push_back({std::move(frame), std::move(on_written)});
+    if (write_in_progress_) {
+        return;
+    }
+    
+    // Hold an idle connection's first frames back so that more can join the
+    // same write; anything urgent, or a full batch, goes out at once
+    if (may_linger && write_linger_.count() > 0 && outbox_.size() < max_write_batch_) {
+        if (!linger_armed_) {
+            linger_armed_ = true;
+            linger_timer_.expires_after(write_linger_);
+            linger_timer_.async_wait(track([this](boost::system::error_code ec) {
+                if (ec || !linger_armed_) {
+                    return;
+                }
+                linger_armed_ = false;
+                if (!write_in_progress_ && stream_open()) {
+                    flush_writes();
+                }
+            }));
+        }
+        return;
+    }
+    
+    flush_writes();
+}
+
+void Client::flush_writes() {
+    if (linger_armed_) {
+        linger_armed_ = false;
+        linger_timer_.cancel();
+    }
+    
+    if (outbox_.empty()) {
+        write_in_progress_ = false;
+        return;
+    }
+
+    // Everything queued since the last write goes out in one gathered write
+    write_in_progress_ = true;
+    writing_.swap(outbox_);
+    write_buffers_.clear();
+    for (const auto& frame : writing_) {
+        write_buffers_.push_back(boost::asio::buffer(*frame.bytes));
+    }
+
+    with_stream([&](auto& stream) {
+        boost::asio::async_write(
+            stream,
+            write_buffers_,
+            track([this, id = connection_id_](boost::system::error_code ec,
+                                              std::size_t /*length*/) {
+                for (auto& frame : writing_) {
+                    if (frame.on_written) {
+                        frame.on_written(!ec);
+                    }
+                }
+                writing_.clear();
+
+                if (ec) {
+                    write_in_progress_ = false;
+                    if (id != connection_id_) {
+                        // The failed write belonged to a previous socket; the
+                        // outbox already holds frames for the current one
+                        if (!outbox_.empty() && stream_open()) {
+                            flush_writes();
+                        }
+                        return;
+                    }
+                    if (ec != boost::asio::error::operation_aborted && ec != boost::asio::error::bad_descriptor) {
+                        ui::print_message("Client", "Send error: " + ec.message(), ui::MessageType::ERROR);
+                    }
+                    fail_outbox();
+                    return;
+                }
+
+                flush_writes();
+            }));
+    });
+}
+
+void Client::fail_outbox() {
+    std::vector<OutboundFrame> failed;
+    failed.swap(outbox_);
+    for (auto& frame : failed) {
+        if (frame.on_written) {
+            frame.on_written(false);
+        }
+    }
+}
+
+bool Client::acquire_window() {
+    std::unique_lock<std::mutex> lock(window_mutex_);
+    if (!on_io_thread()) {
+        auto available = [this]() {
+            return window_used_ < max_inflight_ || !accepting_publishes();
+        };
+        if (external_io_) {
+            // PUBACKs are only processed while the context runs
+            while (!available()) {
+                lock.unlock();
+                run_until([this, &available]() {
+                    std::lock_guard<std::mutex> guard(window_mutex_);
+                    return available();
+                });
+                lock.lock();
+            }
+        } else {
+            window_cv_.wait(lock, available);
+        }
+    }
+    if (!accepting_publishes()) {
         return false;
     }
+    ++window_used_;
+    return true;
+}
+
+void Client::release_window() {
+    std::lock_guard<std::mutex> lock(window_mutex_);
+    if (window_used_ > 0) {
+        --window_used_;
+    }
+    window_cv_.notify_one();
+}
+
+void Client::fail_inflight(size_t keep) {
+    std::deque<InflightPublish> failed;
+    while (inflight_.size() > keep) {
+        failed.push_back(std::move(inflight_.front()));
+        inflight_.pop_front();
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(window_mutex_);
+        window_used_ = static_cast<size_t>(std::count_if(inflight_.begin(), inflight_.end(),
+            [](const InflightPublish& publish) { return publish.windowed; }));
+        window_cv_.notify_all();
+    }
+    
+    for (auto& publish : failed) {
+        if (publish.callback) {
+            publish.callback(false);
+        }
+    }
+}
+
+void Client::connection_lost() {
+    bool was_connected = connected_.exchange(false);
+    
+    close_stream();
+    
+    fail_outbox();
+    
+    // A failed attempt is reported to whoever started it; for a reconnect
+    // attempt that schedules the next one
+    if (connect_callback_) {
+        connect_failed(boost::asio::error::connection_aborted);
+        return;
+    }
+    
+    if (!was_connected) {
+        return;
+    }
+    
+    if (!reconnect_policy_.enabled) {
+        fail_inflight();
+        return;
+    }
+    
+    ui::print_message("Client", "Connection lost, reconnecting...", ui::MessageType::WARNING);
+    
+    // Blocking publish() calls have already returned, so only async
+    // publishes are replayed
+    inflight_.erase(std::remove_if(inflight_.begin(), inflight_.end(),
+                                   [](const InflightPublish& publish) { return !publish.windowed; }),
+                    inflight_.end());
+    reconnecting_ = true;
+    fail_inflight(reconnect_policy_.replay_buffer);
+    
+    reconnect_attempt_ = 0;
+    schedule_reconnect();
+}
+
+void Client::schedule_reconnect() {
+    if (reconnect_policy_.max_attempts > 0 && reconnect_attempt_ >= reconnect_policy_.max_attempts) {
+        ui::print_message("Client", "Giving up after " + std::to_string(reconnect_attempt_) + 
+                         " reconnect attempts", ui::MessageType::ERROR);
+        reconnecting_ = false;
+        fail_inflight();
+        return;
+    }
+    
+    double base = static_cast<double>(reconnect_policy_.initial_delay.count()) *
+                  std::pow(reconnect_policy_.multiplier, static_cast<double>(reconnect_attempt_));
+    base = std::min(base, static_cast<double>(reconnect_policy_.max_delay.count()));
+    std::uniform_real_distribution<double> jitter(0.5, 1.0);
+    auto delay = std::chrono::milliseconds(static_cast<long long>(base * jitter(reconnect_random_)));
+    ++reconnect_attempt_;
+    
+    reconnect_timer_.expires_after(delay);
+    reconnect_timer_.async_wait(track([this](boost::system::error_code ec) {
+        if (ec || !reconnecting_) {
+            return;
+        }
+        
+        begin_connect([this](bool ok) {
+            if (ok) {
+                reconnecting_ = false;
+                reconnect_attempt_ = 0;
+                ui::print_message("Client", "Reconnected", ui::MessageType::SUCCESS);
+            } else if (reconnecting_) {
+                schedule_reconnect();
+            }
+        });
+    }));
+}
+
+void Client::restore_session() {
+    std::vector<std::string> topics;
+    topics.assign(subscriptions_.begin(), subscriptions_.end());
+    
+    if (!topics.empty()) {
+        ui::print_message("Client", "Resubscribing to " + std::to_string(topics.size()) + " topics", 
+                        ui::MessageType::INFO);
+        for (auto& batch : encode_topic_batches(topics)) {
+            queue_frame(std::make_shared<const std::vector<uint8_t>>(
+                Packet(PacketType::SUB, FLAG_BATCH, batch).serialize()), nullptr);
+        }
+    }
+    
+    if (!inflight_.empty()) {
+        ui::print_message("Client", "Replaying " + std::to_string(inflight_.size()) + 
+                         " unacknowledged publishes", ui::MessageType::INFO);
+        for (const auto& publish : inflight_) {
+            queue_frame(publish.frame, nullptr);
+        }
+    }
 }
 
 } // namespace client
-} // namespace tinymq 
\ No newline at end of file
+} // namespace tinymq
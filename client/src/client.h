@@ -1,41 +1,166 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <future>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <random>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include "callback_pool.h"
 #include "packet.h"
+#include "shm_channel.h"
+#include "topic_router.h"
 
 namespace tinymq {
 namespace client {
 
 using MessageCallback = std::function<void(const std::string&, const std::vector<uint8_t>&)>;
 
+// Non-owning view of a received message body
+struct ByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+};
+
+// Zero-copy delivery: topic and message point into the client's read buffer
+// and are only valid for the duration of the call
+using MessageViewCallback = std::function<void(std::string_view, ByteSpan)>;
+
+// Completion of an async_publish: true once the broker's PUBACK arrives,
+// false if the message could not be sent or the connection was lost first
+using PublishCallback = std::function<void(bool)>;
+
+// Completion of async_connect: true once the broker's CONNACK arrives
+using ConnectCallback = std::function<void(bool)>;
+
+// Opt-in automatic reconnection after the connection to the broker is lost.
+// Attempt n waits a random delay in [d/2, d] where d = min(max_delay,
+// initial_delay * multiplier^n), so clients dropped together spread out.
+struct ReconnectPolicy {
+    bool enabled = false;
+    std::chrono::milliseconds initial_delay{100};
+    std::chrono::milliseconds max_delay{30000};
+    double multiplier = 2.0;
+    size_t max_attempts = 0;        // 0 retries forever
+    size_t replay_buffer = 1024;    // Unacknowledged publishes kept for replay
+};
+
 class Client {
 public:
+    // host may also be "unix:/path/to/socket" for a broker on the same machine,
+    // or "shm:/path/to/socket" to reach it through shared memory (see ShmChannel)
     Client(const std::string& client_id, 
            const std::string& host = "localhost", 
            uint16_t port = 1505);
     
+    // Runs on a caller-owned io_context, which may be shared by many clients.
+    // No thread is started: callbacks run wherever the context is run, either
+    // by the caller's own threads or by calling poll() from its event loop.
+    // Blocking calls made outside the context run it themselves until done.
+    Client(boost::asio::io_context& io_context,
+           const std::string& client_id,
+           const std::string& host = "localhost",
+           uint16_t port = 1505);
+    
     ~Client();
     
+    // Blocks until the broker acknowledges the connection or the connect
+    // timeout expires. Must not be called from a client callback.
     bool connect();
+    void async_connect(ConnectCallback callback);
     void disconnect();
     
+    void set_connect_timeout(std::chrono::milliseconds timeout);
+    
+    // With reconnection enabled, a lost connection keeps topic handlers and
+    // up to replay_buffer unacknowledged publishes. async_publish keeps
+    // buffering while reconnecting. After the next CONNACK all handlers are
+    // resubscribed in one batched SUB and the buffered publishes are resent.
+    void set_reconnect_policy(const ReconnectPolicy& policy);
+    
+    // Runs message callbacks on a pool of worker threads instead of the io
+    // thread. Messages on one topic always go to the same worker and keep
+    // their order. When a worker has queue_capacity messages waiting, the
+    // client stops reading from the socket until it has drained halfway.
+    // Call before connect(); 0 workers restores inline callbacks.
+    void set_callback_workers(size_t workers, size_t queue_capacity = 1024);
+    
     bool subscribe(const std::string& topic, const MessageCallback& callback);
+    // Messages for view subscriptions are not logged or copied
+    bool subscribe(const std::string& topic, MessageViewCallback callback);
+    // Subscribes at the broker without a handler of its own; messages go to
+    // the most specific matching wildcard handler (see TopicRouter)
+    bool subscribe(const std::string& topic);
     bool unsubscribe(const std::string& topic);
+    
+    // Registers or removes a handler locally without subscribing at the
+    // broker, e.g. for topics another connection subscribes to
+    bool add_handler(const std::string& filter, const MessageCallback& callback);
+    bool add_handler(const std::string& filter, MessageViewCallback callback);
+    void remove_handler(const std::string& filter);
+    // The message must not be empty: the broker drops such a PUB without a
+    // PUBACK, so it is refused here rather than sent
     bool publish(const std::string& topic, const std::vector<uint8_t>& message);
     bool publish(const std::string& topic, const std::string& message);
     
+    // Pipelined publish: the frame is queued to the io thread, coalesced with
+    // other pending frames into one gathered write, and completed by the
+    // matching PUBACK. Blocks while max_inflight() publishes are unacknowledged,
+    // except when called from the io thread (e.g. inside a callback).
+    void async_publish(const std::string& topic, const std::vector<uint8_t>& message,
+                       PublishCallback callback);
+    std::future<bool> async_publish(const std::string& topic, const std::vector<uint8_t>& message);
+    std::future<bool> async_publish(const std::string& topic, const std::string& message);
+    
+    void set_max_inflight(size_t max_inflight);
+    
+    // Lets async_publish frames wait up to linger on an idle connection so
+    // that later ones share the same write, until max_batch frames are
+    // waiting. Trades that much latency for fewer, fuller writes on slow
+    // links. Other frames are never delayed. Default: no linger.
+    void set_write_linger(std::chrono::milliseconds linger, size_t max_batch = 256);
+    size_t max_inflight() const { return max_inflight_; }
+    
     bool is_connected() const { return connected_; }
+    bool is_reconnecting() const { return reconnecting_; }
     
+    // Runs ready handlers without blocking. With a caller-supplied io_context
+    // this advances every client sharing it.
     void poll();
     
 private:
+    void start_io();
+    void stop_io();
+    void begin_connect(ConnectCallback callback);
+    void send_connect();
+    bool stream_open() const;
+    void close_stream();
+    template <typename Operation>
+    void with_stream(Operation&& operation) {
+        if (shm_) {
+            operation(*shm_);
+        } else {
+            operation(*socket_);
+        }
+    }
+    void connect_failed(const boost::system::error_code& ec);
+    void complete_connect(bool connected);
+    
     void start_read();
     void read_header();
     void read_payload(tinymq::PacketHeader header);
@@ -45,26 +170,130 @@ private:
     void handle_puback(const tinymq::Packet& packet);
     void handle_suback(const tinymq::Packet& packet);
     void handle_unsuback(const tinymq::Packet& packet);
-    void handle_publish(const tinymq::Packet& packet);
+    void handle_publish(const uint8_t* payload, size_t size);
+    void dispatch_callback(std::string_view topic, CallbackPool::Task task);
+    void resume_reading();
     
     bool send_packet(const tinymq::Packet& packet);
+    using Frame = std::shared_ptr<const std::vector<uint8_t>>;
+    bool send_frame(Frame frame, bool expect_puback);
+    static Frame build_publish_frame(const std::string& topic, const std::vector<uint8_t>& message);
+    bool on_io_thread() const;
+    bool io_active() const;
+    
+    // Binds a completion handler to strand_ and counts it as outstanding
+    // until it has run, so a shared io_context can be drained of this
+    // client's handlers before it is destroyed
+    template <typename Handler>
+    auto track(Handler handler) {
+        ++pending_ops_;
+        return boost::asio::bind_executor(strand_, [this, handler = std::move(handler)](auto&&... args) mutable {
+            handler(std::forward<decltype(args)>(args)...);
+            --pending_ops_;
+        });
+    }
+    
+    // Without a dedicated io thread, blocking calls run the io_context
+    // themselves until their operation completes
+    template <typename Predicate>
+    void run_until(Predicate done) {
+        while (!done()) {
+            if (io_context_.stopped()) {
+                io_context_.restart();
+            }
+            io_context_.run_one_for(std::chrono::milliseconds(10));
+        }
+    }
+    bool wait_for(std::future<bool>& result);
+    
+    // Write path; these run on strand_ only
+    using WriteCallback = std::function<void(bool)>;
+    void queue_frame(Frame frame, WriteCallback on_written, bool may_linger = false);
+    void flush_writes();
+    void fail_outbox();
+    
+    bool acquire_window();
+    void release_window();
+    bool accepting_publishes() const { return connected_ || reconnecting_; }
+    void fail_inflight(size_t keep = 0);
+    void connection_lost();
+    
+    void schedule_reconnect();
+    void restore_session();
 
 private:
     std::string client_id_;
     std::string host_;
     uint16_t port_;
-    bool connected_{false};
+    std::atomic<bool> connected_{false};
+    std::atomic<bool> reconnecting_{false};
     
-    boost::asio::io_context io_context_;
-    std::unique_ptr<boost::asio::ip::tcp::socket> socket_;
+    std::unique_ptr<boost::asio::io_context> owned_io_context_;
+    boost::asio::io_context& io_context_;
+    bool external_io_;
+    std::atomic<size_t> pending_ops_{0};
+    boost::asio::strand<boost::asio::io_context::executor_type> strand_;
+    boost::asio::ip::tcp::resolver resolver_;
+    boost::asio::steady_timer connect_timer_;
+    std::chrono::milliseconds connect_timeout_{5000};
+    ConnectCallback connect_callback_;
+    // A TCP or Unix domain socket, depending on host_
+    std::unique_ptr<boost::asio::generic::stream_protocol::socket> socket_;
+    std::shared_ptr<ShmChannel> shm_;   // Carries the connection instead of socket_ for "shm:" hosts
+    uint64_t connection_id_{0};     // Bumped per connection attempt to discard stale completions
+    std::optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work_guard_;
     
     std::thread io_thread_;
-    std::mutex mutex_;
     
     std::vector<uint8_t> read_buffer_;
     static constexpr size_t header_length = 4;
     
-    std::unordered_map<std::string, MessageCallback> topic_handlers_;
+    struct TopicHandler {
+        MessageCallback callback;
+        MessageViewCallback view_callback;
+    };
+    bool add_subscription(const std::string& topic, TopicHandler handler);
+    bool install_handler(const std::string& filter, TopicHandler handler);
+    
+    // Modified and read on strand_ only. Handlers are keyed by topic filter;
+    // subscriptions_ holds every topic subscribed at the broker.
+    TopicRouter<TopicHandler> topic_handlers_;
+    std::unordered_set<std::string> subscriptions_;
+    
+    std::unique_ptr<CallbackPool> callback_pool_;
+    bool read_paused_{false};       // strand_ only
+    
+    struct OutboundFrame {
+        Frame bytes;
+        WriteCallback on_written;
+    };
+    std::vector<OutboundFrame> outbox_;
+    std::vector<OutboundFrame> writing_;
+    std::vector<boost::asio::const_buffer> write_buffers_;
+    bool write_in_progress_{false};
+    std::chrono::milliseconds write_linger_{0};
+    size_t max_write_batch_{256};
+    boost::asio::steady_timer linger_timer_;
+    bool linger_armed_{false};
+    
+    // PUBs awaiting PUBACK, in send order. The broker acknowledges each
+    // session's publishes in order, so acknowledgements are matched FIFO.
+    struct InflightPublish {
+        Frame frame;
+        PublishCallback callback;
+        bool windowed;
+    };
+    std::deque<InflightPublish> inflight_;
+    
+    std::mutex window_mutex_;
+    std::condition_variable window_cv_;
+    size_t window_used_{0};
+    size_t max_inflight_{1024};
+    
+    ReconnectPolicy reconnect_policy_;
+    boost::asio::steady_timer reconnect_timer_;
+    size_t reconnect_attempt_{0};
+    std::minstd_rand reconnect_random_;
 };
 
 } // namespace client
@@ -0,0 +1,155 @@
+#include "client_pool.h"
+#include <algorithm>
+#include <functional>
+#include <thread>
+
+namespace tinymq {
+namespace client {
+
+ClientPool::ClientPool(const std::string& client_id, const std::string& host, uint16_t port,
+                       size_t connections) {
+    if (connections == 0) {
+        connections = std::max(1u, std::thread::hardware_concurrency());
+    }
+    connections_.reserve(connections);
+    for (size_t i = 0; i < connections; ++i) {
+        connections_.push_back(std::make_unique<Client>(client_id + "-" + std::to_string(i), host, port));
+    }
+}
+
+ClientPool::~ClientPool() {
+    disconnect();
+}
+
+bool ClientPool::connect() {
+    std::vector<std::future<bool>> results;
+    results.reserve(connections_.size());
+    for (auto& client : connections_) {
+        auto done = std::make_shared<std::promise<bool>>();
+        results.push_back(done->get_future());
+        client->async_connect([done](bool ok) {
+            done->set_value(ok);
+        });
+    }
+
+    bool connected = true;
+    for (auto& result : results) {
+        connected = result.get() && connected;
+    }
+    if (!connected) {
+        disconnect();
+    }
+    return connected;
+}
+
+void ClientPool::disconnect() {
+    for (auto& client : connections_) {
+        client->disconnect();
+    }
+}
+
+bool ClientPool::is_connected() const {
+    for (const auto& client : connections_) {
+        if (!client->is_connected()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ClientPool::set_connect_timeout(std::chrono::milliseconds timeout) {
+    for (auto& client : connections_) {
+        client->set_connect_timeout(timeout);
+    }
+}
+
+void ClientPool::set_reconnect_policy(const ReconnectPolicy& policy) {
+    for (auto& client : connections_) {
+        client->set_reconnect_policy(policy);
+    }
+}
+
+void ClientPool::set_max_inflight(size_t max_inflight) {
+    for (auto& client : connections_) {
+        client->set_max_inflight(max_inflight);
+    }
+}
+
+void ClientPool::set_write_linger(std::chrono::milliseconds linger, size_t max_batch) {
+    for (auto& client : connections_) {
+        client->set_write_linger(linger, max_batch);
+    }
+}
+
+void ClientPool::set_callback_workers(size_t workers, size_t queue_capacity) {
+    for (auto& client : connections_) {
+        client->set_callback_workers(workers, queue_capacity);
+    }
+}
+
+Client& ClientPool::connection_for(const std::string& topic) {
+    return *connections_[std::hash<std::string>{}(topic) % connections_.size()];
+}
+
+template <typename Callback>
+bool ClientPool::subscribe_with_handler(const std::string& topic, const Callback& callback) {
+    bool added = true;
+    for (auto& client : connections_) {
+        if (!client->add_handler(topic, callback)) {
+            added = false;
+            break;
+        }
+    }
+    if (added && subscribe(topic)) {
+        return true;
+    }
+
+    // A retry would otherwise register a second handler and deliver twice
+    for (auto& client : connections_) {
+        client->remove_handler(topic);
+    }
+    return false;
+}
+
+bool ClientPool::subscribe(const std::string& topic, const MessageCallback& callback) {
+    return subscribe_with_handler(topic, callback);
+}
+
+bool ClientPool::subscribe(const std::string& topic, MessageViewCallback callback) {
+    return subscribe_with_handler(topic, callback);
+}
+
+bool ClientPool::subscribe(const std::string& topic) {
+    return connection_for(topic).subscribe(topic);
+}
+
+bool ClientPool::unsubscribe(const std::string& topic) {
+    for (auto& client : connections_) {
+        client->remove_handler(topic);
+    }
+    return connection_for(topic).unsubscribe(topic);
+}
+
+bool ClientPool::publish(const std::string& topic, const std::vector<uint8_t>& message) {
+    return connection_for(topic).publish(topic, message);
+}
+
+bool ClientPool::publish(const std::string& topic, const std::string& message) {
+    return connection_for(topic).publish(topic, message);
+}
+
+void ClientPool::async_publish(const std::string& topic, const std::vector<uint8_t>& message,
+                               PublishCallback callback) {
+    connection_for(topic).async_publish(topic, message, std::move(callback));
+}
+
+std::future<bool> ClientPool::async_publish(const std::string& topic, const std::vector<uint8_t>& message) {
+    return connection_for(topic).async_publish(topic, message);
+}
+
+std::future<bool> ClientPool::async_publish(const std::string& topic, const std::string& message) {
+    return connection_for(topic).async_publish(topic, message);
+}
+
+} // namespace client
+} // namespace tinymq
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include "client.h"
+
+namespace tinymq {
+namespace client {
+
+// Spreads one logical client over several broker connections, each with its
+// own io thread, so framing and socket work can use more than one core.
+// Connection i uses the client id "<client_id>-<i>". Publishes and broker
+// subscriptions go to the connection picked by hashing the topic, which
+// keeps each topic's messages in order. Handlers are registered on every
+// connection, so whichever one receives a message dispatches it.
+class ClientPool {
+public:
+    ClientPool(const std::string& client_id,
+               const std::string& host = "localhost",
+               uint16_t port = 1505,
+               size_t connections = 0);  // 0 uses one per hardware thread
+    ~ClientPool();
+
+    ClientPool(const ClientPool&) = delete;
+    ClientPool& operator=(const ClientPool&) = delete;
+
+    // Connects all connections in parallel; fails, leaving none connected,
+    // unless every connection succeeds
+    bool connect();
+    void disconnect();
+    bool is_connected() const;
+
+    // Applied to every connection; call before connect()
+    void set_connect_timeout(std::chrono::milliseconds timeout);
+    void set_reconnect_policy(const ReconnectPolicy& policy);
+    void set_max_inflight(size_t max_inflight);
+    void set_write_linger(std::chrono::milliseconds linger, size_t max_batch = 256);
+    void set_callback_workers(size_t workers, size_t queue_capacity = 1024);
+
+    bool subscribe(const std::string& topic, const MessageCallback& callback);
+    bool subscribe(const std::string& topic, MessageViewCallback callback);
+    bool subscribe(const std::string& topic);
+    bool unsubscribe(const std::string& topic);
+
+    bool publish(const std::string& topic, const std::vector<uint8_t>& message);
+    bool publish(const std::string& topic, const std::string& message);
+    void async_publish(const std::string& topic, const std::vector<uint8_t>& message,
+                       PublishCallback callback);
+    std::future<bool> async_publish(const std::string& topic, const std::vector<uint8_t>& message);
+    std::future<bool> async_publish(const std::string& topic, const std::string& message);
+
+    size_t size() const { return connections_.size(); }
+    Client& connection(size_t index) { return *connections_[index]; }
+    Client& connection_for(const std::string& topic);
+
+private:
+    // Registers callback on every connection, then subscribes at the broker;
+    // on any failure the handlers are removed again
+    template <typename Callback>
+    bool subscribe_with_handler(const std::string& topic, const Callback& callback);
+
+    std::vector<std::unique_ptr<Client>> connections_;
+};
+
+} // namespace client
+} // namespace tinymq
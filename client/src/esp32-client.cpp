@@ -1,60 +1,541 @@
 #include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <set>
 #include <string>
-#include <thread>
-#include "json.hpp"
+#include <string_view>
+#include <vector>
 #include "client.h"
+#include "record_parser.h"
+#include "spool.h"
 
 using boost::asio::ip::tcp;
-using json = nlohmann::json;
 
-const int port = 12345;
+const int default_port = 12345;
+const size_t max_line_length = 4096;
+const auto stats_interval = std::chrono::seconds(30);
+const auto maintenance_interval = std::chrono::seconds(1);
+const auto max_connect_delay = std::chrono::seconds(30);
+const size_t drain_batch = 1024;
 
-int main() {
-    try {
-        boost::asio::io_context io;
+enum class Delivery { acked, spooled, failed };
 
-        // Start TinyMQ client
-        tinymq::client::Client client("esp32");
-        if (!client.connect()) {
-            std::cerr << "Failed to connect to TinyMQ broker." << std::endl;
-            return 1;
+struct IngestOptions {
+    tinymq::gateway::RecordEncoding encoding = tinymq::gateway::RecordEncoding::json;
+    bool publish_raw = false;   // Publish each line or frame as received instead of its data
+};
+
+// Sends readings to the broker. With a spool, readings that cannot be sent
+// now go to disk and are sent in order, in batches, once the broker is back;
+// until the spool is empty new readings queue up behind them.
+class Uplink {
+public:
+    Uplink(boost::asio::io_context& io, tinymq::client::Client& client,
+           std::unique_ptr<tinymq::gateway::Spool> spool)
+        : maintenance_timer_(io),
+          client_(client),
+          spool_(std::move(spool)) {
+    }
+
+    void start() {
+        schedule_maintenance();
+    }
+
+    void stop() {
+        maintenance_timer_.cancel();
+        if (spool_) {
+            spool_->sync();
         }
+    }
 
-        tcp::acceptor acceptor(io, tcp::endpoint(tcp::v4(), port));
-        std::cout << "Listening on port " << port << std::endl;
+    // done is called once, possibly before forward() returns
+    void forward(std::string_view topic, std::string_view data, std::function<void(Delivery)> done) {
+        // The broker cannot carry an empty reading; spooling it would block the drain
+        if (data.empty()) {
+            done(Delivery::failed);
+            return;
+        }
+        if (spool_ && (!client_.is_connected() || draining_ || !spool_->empty())) {
+            done(spool_->append(topic, data) ? Delivery::spooled : Delivery::failed);
+            return;
+        }
+
+        std::vector<uint8_t> message(data.begin(), data.end());
+        if (!spool_) {
+            client_.async_publish(std::string(topic), message, [done = std::move(done)](bool acked) {
+                done(acked ? Delivery::acked : Delivery::failed);
+            });
+            return;
+        }
+
+        client_.async_publish(std::string(topic), message,
+            [this, topic = std::string(topic), data = std::string(data), done = std::move(done)](bool acked) {
+                if (acked) {
+                    done(Delivery::acked);
+                } else {
+                    done(spool_->append(topic, data) ? Delivery::spooled : Delivery::failed);
+                }
+            });
+    }
+
+    void print_stats() const {
+        if (spool_) {
+            std::cout << "Spool: " << spool_->size_bytes() << " bytes on disk, drained=" << drained_
+                      << " dropped_bytes=" << spool_->dropped_bytes() << std::endl;
+        }
+    }
+
+private:
+    void schedule_maintenance() {
+        maintenance_timer_.expires_after(maintenance_interval);
+        maintenance_timer_.async_wait([this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            reconnect_if_idle();
+            if (spool_) {
+                spool_->sync();
+                drain();
+            }
+            schedule_maintenance();
+        });
+    }
+
+    // The client reconnects by itself once it has been connected; this covers
+    // a broker that was not reachable when the gateway started
+    void reconnect_if_idle() {
+        if (client_.is_connected() || client_.is_reconnecting() || connecting_) {
+            connect_delay_ = maintenance_interval;
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now < next_connect_) {
+            return;
+        }
 
-        while (true) {
-            tcp::socket socket(io);
-            acceptor.accept(socket);
-            std::cout << "Client connected." << std::endl;
+        connecting_ = true;
+        client_.async_connect([this](bool connected) {
+            connecting_ = false;
+            if (connected) {
+                drain();
+            } else {
+                next_connect_ = std::chrono::steady_clock::now() + connect_delay_;
+                connect_delay_ = std::min<std::chrono::steady_clock::duration>(connect_delay_ * 2, max_connect_delay);
+            }
+        });
+    }
+
+    // Publishes the next batch from the spool and commits it once every
+    // reading in it is acknowledged. After a failure the batch is read again
+    // on a later tick, so some readings may reach the broker twice.
+    void drain() {
+        if (draining_ || !client_.is_connected() || spool_->empty()) {
+            return;
+        }
+        if (spool_->read_batch(drain_batch, batch_, batch_end_) == 0) {
+            return;
+        }
+
+        draining_ = true;
+        auto remaining = std::make_shared<size_t>(batch_.size());
+        auto failed = std::make_shared<bool>(false);
+        for (const auto& record : batch_) {
+            if (record.data.empty()) {
+                // Never publishable, so dropped instead of retried forever
+                if (--*remaining == 0) {
+                    finish_batch(!*failed);
+                }
+                continue;
+            }
+            client_.async_publish(record.topic, std::vector<uint8_t>(record.data.begin(), record.data.end()),
+                [this, remaining, failed](bool acked) {
+                    *failed = *failed || !acked;
+                    if (--*remaining == 0) {
+                        finish_batch(!*failed);
+                    }
+                });
+        }
+    }
 
-            boost::asio::streambuf buffer;
-            boost::system::error_code ec;
+    void finish_batch(bool delivered) {
+        draining_ = false;
+        if (!delivered) {
+            return;
+        }
+        spool_->commit(batch_end_);
+        drained_ += batch_.size();
+        boost::asio::post(maintenance_timer_.get_executor(), [this]() {
+            drain();
+        });
+    }
+
+    boost::asio::steady_timer maintenance_timer_;
+    tinymq::client::Client& client_;
+    std::unique_ptr<tinymq::gateway::Spool> spool_;
+    std::vector<tinymq::gateway::SpoolRecord> batch_;
+    tinymq::gateway::SpoolPosition batch_end_;
+    bool draining_ = false;
+    bool connecting_ = false;
+    std::chrono::steady_clock::time_point next_connect_;
+    std::chrono::steady_clock::duration connect_delay_ = maintenance_interval;
+    uint64_t drained_ = 0;
+};
 
-            while (boost::asio::read_until(socket, buffer, "\n", ec)) {
-                std::istream is(&buffer);
+// One connected device. Records are read asynchronously, so any number of
+// devices stream at once over the gateway's single io thread.
+class DeviceSession : public std::enable_shared_from_this<DeviceSession> {
+public:
+    DeviceSession(tcp::socket socket, Uplink& upstream, std::set<DeviceSession*>& devices,
+                  const IngestOptions& ingest)
+        : socket_(std::move(socket)),
+          buffer_(max_line_length),
+          upstream_(upstream),
+          devices_(devices),
+          ingest_(ingest) {
+        boost::system::error_code ec;
+        auto endpoint = socket_.remote_endpoint(ec);
+        name_ = ec ? "unknown" : endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+    }
+
+    ~DeviceSession() {
+        devices_.erase(this);
+    }
+
+    void start() {
+        devices_.insert(this);
+        std::cout << "Device " << name_ << " connected (" << devices_.size() << " active)" << std::endl;
+        if (ingest_.encoding == tinymq::gateway::RecordEncoding::json) {
+            read_line();
+        } else {
+            frames_.resize(4 * (tinymq::gateway::frame_header_length + max_line_length));
+            read_frames();
+        }
+    }
+
+    void close() {
+        boost::system::error_code ec;
+        socket_.close(ec);
+    }
+
+    void print_stats() const {
+        std::cout << "  " << name_ << ": lines=" << lines_ << " published=" << published_
+                  << " acked=" << acked_ << " spooled=" << spooled_ << " failed=" << failed_ << " invalid=" << invalid_
+                  << " bytes=" << bytes_ << std::endl;
+    }
+
+private:
+    void read_line() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(socket_, buffer_, '\n',
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    report_disconnect(ec);
+                    return;
+                }
+
+                std::istream is(&buffer_);
                 std::string line;
                 std::getline(is, line);
+                bytes_ += length;
+                ++lines_;
+                handle_record(line);
+
+                read_line();
+            });
+    }
+
+    // Reads as many length-prefixed frames as are available per receive
+    void read_frames() {
+        auto self = shared_from_this();
+        socket_.async_read_some(boost::asio::buffer(frames_.data() + frames_size_, frames_.size() - frames_size_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    report_disconnect(ec);
+                    return;
+                }
+                bytes_ += length;
+                frames_size_ += length;
 
-                try {
-                    auto parsed = json::parse(line);
-                    std::string topic = parsed["topic"];
-                    std::string data = parsed["data"];
-                    std::cout << "Publishing [" << topic << "]: " << data << std::endl;
-                    client.publish(topic, data);
-                } catch (const std::exception& e) {
-                    std::cerr << "Invalid JSON: " << e.what() << std::endl;
+                size_t offset = 0;
+                while (frames_size_ - offset >= tinymq::gateway::frame_header_length) {
+                    size_t frame_length = tinymq::gateway::read_frame_length(frames_.data() + offset);
+                    if (frame_length > max_line_length) {
+                        report_disconnect(boost::asio::error::not_found);
+                        return;
+                    }
+                    size_t end = offset + tinymq::gateway::frame_header_length + frame_length;
+                    if (end > frames_size_) {
+                        break;
+                    }
+                    ++lines_;
+                    handle_record(std::string_view(frames_.data() + offset + tinymq::gateway::frame_header_length,
+                                                   frame_length));
+                    offset = end;
                 }
+
+                std::memmove(frames_.data(), frames_.data() + offset, frames_size_ - offset);
+                frames_size_ -= offset;
+                read_frames();
+            });
+    }
+
+    void handle_record(std::string_view input) {
+        try {
+            tinymq::gateway::parse_record(input, record_, ingest_.encoding);
+        } catch (const std::exception& e) {
+            ++invalid_;
+            std::cerr << "Invalid record from " << name_ << ": " << e.what() << std::endl;
+            return;
+        }
+
+        std::string_view payload = ingest_.publish_raw ? input : record_.data;
+        if (ingest_.encoding == tinymq::gateway::RecordEncoding::json && !ingest_.publish_raw) {
+            std::cout << "Publishing [" << record_.topic << "] from " << name_ << ": " << payload << std::endl;
+        } else {
+            std::cout << "Publishing [" << record_.topic << "] from " << name_ << ": " << payload.size()
+                      << " bytes" << std::endl;
+        }
+
+        // Called on the io thread, so this never blocks the other devices
+        auto self = shared_from_this();
+        ++published_;
+        upstream_.forward(record_.topic, payload, [self](Delivery delivery) {
+            if (delivery == Delivery::acked) {
+                ++self->acked_;
+            } else if (delivery == Delivery::spooled) {
+                ++self->spooled_;
+            } else {
+                ++self->failed_;
+            }
+        });
+    }
+
+    void report_disconnect(const boost::system::error_code& ec) {
+        if (ec == boost::asio::error::eof) {
+            std::cout << "Device " << name_ << " disconnected gracefully." << std::endl;
+        } else if (ec == boost::asio::error::connection_reset) {
+            std::cout << "Device " << name_ << " disconnected unexpectedly." << std::endl;
+        } else if (ec == boost::asio::error::not_found) {
+            std::cerr << "Device " << name_ << " sent a record longer than " << max_line_length
+                      << " bytes; closing." << std::endl;
+        } else if (ec != boost::asio::error::operation_aborted) {
+            std::cerr << "Read error from " << name_ << ": " << ec.message() << std::endl;
+        }
+        print_stats();
+    }
+
+    tcp::socket socket_;
+    boost::asio::streambuf buffer_;
+    Uplink& upstream_;
+    std::set<DeviceSession*>& devices_;
+    const IngestOptions& ingest_;
+    std::vector<char> frames_;
+    size_t frames_size_ = 0;
+    std::string name_;
+    tinymq::gateway::SensorRecord record_;
+
+    uint64_t lines_ = 0;
+    uint64_t published_ = 0;
+    uint64_t invalid_ = 0;
+    uint64_t bytes_ = 0;
+    std::atomic<uint64_t> acked_{0};
+    std::atomic<uint64_t> spooled_{0};
+    std::atomic<uint64_t> failed_{0};
+};
+
+class Gateway {
+public:
+    Gateway(boost::asio::io_context& io, Uplink& upstream, uint16_t port, const IngestOptions& ingest)
+        : acceptor_(io, tcp::endpoint(tcp::v4(), port)),
+          stats_timer_(io),
+          upstream_(upstream),
+          ingest_(ingest) {
+    }
+
+    void start() {
+        upstream_.start();
+        accept();
+        schedule_stats();
+    }
+
+    void stop() {
+        boost::system::error_code ec;
+        acceptor_.close(ec);
+        stats_timer_.cancel();
+        upstream_.stop();
+        print_stats();
+        for (DeviceSession* device : devices_) {
+            device->close();
+        }
+    }
+
+private:
+    void accept() {
+        acceptor_.async_accept([this](boost::system::error_code ec, tcp::socket socket) {
+            if (ec) {
+                if (ec != boost::asio::error::operation_aborted) {
+                    std::cerr << "Accept error: " << ec.message() << std::endl;
+                    accept();
+                }
+                return;
+            }
+
+            boost::system::error_code option_ec;
+            socket.set_option(tcp::no_delay(true), option_ec);
+            std::make_shared<DeviceSession>(std::move(socket), upstream_, devices_, ingest_)->start();
+            accept();
+        });
+    }
+
+    void schedule_stats() {
+        stats_timer_.expires_after(stats_interval);
+        stats_timer_.async_wait([this](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            print_stats();
+            schedule_stats();
+        });
+    }
+
+    void print_stats() const {
+        std::cout << "Active devices: " << devices_.size() << std::endl;
+        upstream_.print_stats();
+        for (const DeviceSession* device : devices_) {
+            device->print_stats();
+        }
+    }
+
+    tcp::acceptor acceptor_;
+    boost::asio::steady_timer stats_timer_;
+    Uplink& upstream_;
+    IngestOptions ingest_;
+    std::set<DeviceSession*> devices_;
+};
+
+int main(int argc, char* argv[]) {
+    uint16_t port = default_port;
+    std::string broker_host = "localhost";
+    uint16_t broker_port = 1505;
+    std::chrono::milliseconds linger(5);
+    size_t max_batch = 256;
+    std::string spool_dir;
+    uint64_t spool_max_mb = 256;
+    IngestOptions ingest;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--broker-host" && i + 1 < argc) {
+            broker_host = argv[++i];
+        } else if (arg == "--broker-port" && i + 1 < argc) {
+            broker_port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--linger" && i + 1 < argc) {
+            linger = std::chrono::milliseconds(std::stol(argv[++i]));
+        } else if (arg == "--max-batch" && i + 1 < argc) {
+            max_batch = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--ingest" && i + 1 < argc) {
+            std::string encoding = argv[++i];
+            if (encoding == "json") {
+                ingest.encoding = tinymq::gateway::RecordEncoding::json;
+            } else if (encoding == "cbor") {
+                ingest.encoding = tinymq::gateway::RecordEncoding::cbor;
+            } else if (encoding == "msgpack") {
+                ingest.encoding = tinymq::gateway::RecordEncoding::msgpack;
+            } else {
+                std::cerr << "Unknown ingest encoding: " << encoding << std::endl;
+                return 1;
+            }
+        } else if (arg == "--publish-raw") {
+            ingest.publish_raw = true;
+        } else if (arg == "--spool-dir" && i + 1 < argc) {
+            spool_dir = argv[++i];
+        } else if (arg == "--spool-max-mb" && i + 1 < argc) {
+            spool_max_mb = std::stoull(argv[++i]);
+        } else if (arg == "--help") {
+            std::cout << "TinyMQ ESP32 Gateway" << std::endl;
+            std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
+            std::cout << "Options:" << std::endl;
+            std::cout << "  --port PORT         Port devices connect to (default: 12345)" << std::endl;
+            std::cout << "  --broker-host HOST  Broker address (default: localhost)" << std::endl;
+            std::cout << "  --broker-port PORT  Broker port (default: 1505)" << std::endl;
+            std::cout << "  --linger MS         Wait up to MS for readings to batch into one write (default: 5)" << std::endl;
+            std::cout << "  --max-batch N       Write as soon as N readings are waiting (default: 256)" << std::endl;
+            std::cout << "  --ingest FORMAT     Device record format: json, cbor or msgpack (default: json)" << std::endl;
+            std::cout << "  --publish-raw       Publish records as received instead of their data" << std::endl;
+            std::cout << "  --spool-dir DIR     Store readings in DIR while the broker is unreachable" << std::endl;
+            std::cout << "  --spool-max-mb N    Spool size limit; the oldest readings are dropped beyond it (default: 256)" << std::endl;
+            std::cout << "  --help              Show this help message" << std::endl;
+            return 0;
+        }
+    }
+
+    try {
+        boost::asio::io_context io;
+
+        // The upstream client shares the gateway's io_context, so devices and
+        // the broker connection are all served by this one thread
+        tinymq::client::Client client(io, "esp32", broker_host, broker_port);
+        tinymq::client::ReconnectPolicy reconnect;
+        reconnect.enabled = true;
+        client.set_reconnect_policy(reconnect);
+        client.set_write_linger(linger, max_batch);
+
+        std::unique_ptr<tinymq::gateway::Spool> spool;
+        if (!spool_dir.empty()) {
+            tinymq::gateway::SpoolOptions options;
+            options.directory = spool_dir;
+            options.max_bytes = spool_max_mb << 20;
+            spool = std::make_unique<tinymq::gateway::Spool>(options);
+        }
+
+        // With a spool the gateway starts without a broker and keeps trying
+        if (!client.connect()) {
+            if (!spool) {
+                std::cerr << "Failed to connect to TinyMQ broker." << std::endl;
+                return 1;
+            }
+            std::cerr << "Broker unreachable; spooling readings to " << spool_dir << std::endl;
+        }
+
+        Uplink uplink(io, client, std::move(spool));
+        Gateway gateway(io, uplink, port, ingest);
+        gateway.start();
+        std::cout << "Listening on port " << port << std::endl;
+
+        boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+        // Closing everything lets run() return once the outstanding handlers
+        // have completed, so no session outlives the gateway
+        bool stopped = false;
+        auto shutdown = [&]() {
+            if (stopped) {
+                return;
             }
+            stopped = true;
+            signals.cancel();
+            gateway.stop();
+            client.disconnect();
+        };
+        signals.async_wait([&](boost::system::error_code, int) {
+            shutdown();
+        });
 
-            // Handle disconnects and other errors
-            if (ec == boost::asio::error::eof) {
-                std::cout << "Client disconnected gracefully." << std::endl;
-            } else if (ec == boost::asio::error::connection_reset) {
-                std::cout << "Client disconnected unexpectedly." << std::endl;
-            } else if (ec) {
-                std::cerr << "Read error: " << ec.message() << std::endl;
+        // A handler that throws must not unwind past the uplink and gateway
+        // while the client's callbacks and pending device handlers still use
+        // them; shut down in order here and let the remaining handlers finish
+        for (;;) {
+            try {
+                io.run();
+                break;
+            } catch (const std::exception& e) {
+                std::cerr << "Server error: " << e.what() << std::endl;
+                shutdown();
             }
         }
     } catch (const std::exception& e) {
@@ -0,0 +1,299 @@
+#include "record_parser.h"
+#include "json.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace tinymq {
+namespace gateway {
+
+namespace {
+
+bool is_plain(unsigned char c) {
+    return c != '"' && c != '\\' && c >= 0x20 && c < 0x80;
+}
+
+// Returns the first byte that is not plain string content: a quote, a
+// backslash, a control character or a non-ASCII byte
+const char* scan_string(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control_max = _mm_set1_epi8(0x1F);
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i stop = _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash));
+        // Unsigned chunk <= 0x1F; the sign bit covers bytes >= 0x80
+        stop = _mm_or_si128(stop, _mm_cmpeq_epi8(_mm_max_epu8(chunk, control_max), control_max));
+        int mask = _mm_movemask_epi8(stop) | _mm_movemask_epi8(chunk);
+        if (mask != 0) {
+            return p + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && is_plain(static_cast<unsigned char>(*p))) {
+        ++p;
+    }
+    return p;
+}
+
+const char* skip_whitespace(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+        ++p;
+    }
+    return p;
+}
+
+// Parses a string without escapes starting at the opening quote
+bool read_string(const char*& p, const char* end, std::string_view& out) {
+    if (p == end || *p != '"') {
+        return false;
+    }
+    const char* start = p + 1;
+    const char* stop = scan_string(start, end);
+    if (stop == end || *stop != '"') {
+        return false;
+    }
+    out = std::string_view(start, static_cast<size_t>(stop - start));
+    p = stop + 1;
+    return true;
+}
+
+// Reads binary items from a frame; every read fails once past the end
+class ItemReader {
+public:
+    explicit ItemReader(std::string_view frame)
+        : p_(reinterpret_cast<const unsigned char*>(frame.data())), end_(p_ + frame.size()) {}
+
+    bool at_end() const { return p_ == end_; }
+
+    bool byte(unsigned char& out) {
+        if (p_ == end_) {
+            return false;
+        }
+        out = *p_++;
+        return true;
+    }
+
+    bool number(size_t bytes, size_t& out) {
+        if (static_cast<size_t>(end_ - p_) < bytes) {
+            return false;
+        }
+        out = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            out = (out << 8) | *p_++;
+        }
+        return true;
+    }
+
+    bool view(size_t length, std::string_view& out) {
+        if (static_cast<size_t>(end_ - p_) < length) {
+            return false;
+        }
+        out = std::string_view(reinterpret_cast<const char*>(p_), length);
+        p_ += length;
+        return true;
+    }
+
+private:
+    const unsigned char* p_;
+    const unsigned char* end_;
+};
+
+// Text (major type 3) or, for values, byte string (major type 2)
+bool read_cbor_string(ItemReader& in, bool allow_bytes, std::string_view& out) {
+    unsigned char initial;
+    if (!in.byte(initial)) {
+        return false;
+    }
+    unsigned char major = initial >> 5;
+    unsigned char info = initial & 0x1F;
+    if (major != 3 && !(allow_bytes && major == 2)) {
+        return false;
+    }
+
+    size_t length = info;
+    if (info == 24 || info == 25 || info == 26) {
+        if (!in.number(size_t(1) << (info - 24), length)) {
+            return false;
+        }
+    } else if (info > 23) {
+        return false;       // 64-bit or indefinite length
+    }
+    return in.view(length, out);
+}
+
+bool read_msgpack_string(ItemReader& in, bool allow_bytes, std::string_view& out) {
+    unsigned char type;
+    if (!in.byte(type)) {
+        return false;
+    }
+
+    size_t length = 0;
+    bool ok = true;
+    if ((type & 0xE0) == 0xA0) {
+        length = type & 0x1F;
+    } else if (type == 0xD9 || (allow_bytes && type == 0xC4)) {
+        ok = in.number(1, length);
+    } else if (type == 0xDA || (allow_bytes && type == 0xC5)) {
+        ok = in.number(2, length);
+    } else if (type == 0xDB || (allow_bytes && type == 0xC6)) {
+        ok = in.number(4, length);
+    } else {
+        return false;
+    }
+    return ok && in.view(length, out);
+}
+
+// The map header has been read; takes both entries in either order
+template <typename ReadString>
+bool read_record_entries(ItemReader& in, ReadString read_string, SensorRecord& record) {
+    bool have_topic = false;
+    bool have_data = false;
+    for (int i = 0; i < 2; ++i) {
+        std::string_view key;
+        if (!read_string(in, false, key)) {
+            return false;
+        }
+        if (key == "topic" && !have_topic) {
+            have_topic = true;
+            if (!read_string(in, false, record.topic)) {
+                return false;
+            }
+        } else if (key == "data" && !have_data) {
+            have_data = true;
+            if (!read_string(in, true, record.data)) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return have_topic && have_data && in.at_end();
+}
+
+void parse_record_fallback(const nlohmann::json& parsed, SensorRecord& record) {
+    record.topic_storage = parsed.at("topic").get<std::string>();
+    const auto& data = parsed.at("data");
+    if (data.is_string()) {
+        record.data_storage = data.get<std::string>();
+    } else if (data.is_binary()) {
+        record.data_storage.assign(data.get_binary().begin(), data.get_binary().end());
+    } else {
+        record.data_storage = data.dump();
+    }
+    record.topic = record.topic_storage;
+    record.data = record.data_storage;
+}
+
+} // namespace
+
+bool parse_record_fast(std::string_view line, SensorRecord& record) {
+    const char* p = line.data();
+    const char* end = p + line.size();
+
+    p = skip_whitespace(p, end);
+    if (p == end || *p != '{') {
+        return false;
+    }
+    ++p;
+
+    bool have_topic = false;
+    bool have_data = false;
+    while (true) {
+        std::string_view key;
+        std::string_view value;
+        p = skip_whitespace(p, end);
+        if (!read_string(p, end, key)) {
+            return false;
+        }
+        p = skip_whitespace(p, end);
+        if (p == end || *p != ':') {
+            return false;
+        }
+        p = skip_whitespace(p + 1, end);
+        if (!read_string(p, end, value)) {
+            return false;
+        }
+
+        if (key == "topic" && !have_topic) {
+            record.topic = value;
+            have_topic = true;
+        } else if (key == "data" && !have_data) {
+            record.data = value;
+            have_data = true;
+        } else {
+            return false;
+        }
+
+        p = skip_whitespace(p, end);
+        if (p == end) {
+            return false;
+        }
+        if (*p == '}') {
+            ++p;
+            break;
+        }
+        if (*p != ',') {
+            return false;
+        }
+        ++p;
+    }
+
+    return have_topic && have_data && skip_whitespace(p, end) == end;
+}
+
+bool parse_record_cbor_fast(std::string_view frame, SensorRecord& record) {
+    ItemReader in(frame);
+    unsigned char header;
+    if (!in.byte(header) || header != 0xA2) {
+        return false;
+    }
+    return read_record_entries(in, read_cbor_string, record);
+}
+
+bool parse_record_msgpack_fast(std::string_view frame, SensorRecord& record) {
+    ItemReader in(frame);
+    unsigned char header;
+    size_t entries = 0;
+    if (!in.byte(header)) {
+        return false;
+    }
+    if (header == 0x82) {
+        entries = 2;
+    } else if (header == 0xDE && !in.number(2, entries)) {
+        return false;
+    }
+    if (entries != 2) {
+        return false;
+    }
+    return read_record_entries(in, read_msgpack_string, record);
+}
+
+void parse_record(std::string_view input, SensorRecord& record, RecordEncoding encoding) {
+    switch (encoding) {
+    case RecordEncoding::json:
+        if (parse_record_fast(input, record)) {
+            return;
+        }
+        parse_record_fallback(nlohmann::json::parse(input.begin(), input.end()), record);
+        break;
+    case RecordEncoding::cbor:
+        if (parse_record_cbor_fast(input, record)) {
+            return;
+        }
+        parse_record_fallback(nlohmann::json::from_cbor(input.begin(), input.end()), record);
+        break;
+    case RecordEncoding::msgpack:
+        if (parse_record_msgpack_fast(input, record)) {
+            return;
+        }
+        parse_record_fallback(nlohmann::json::from_msgpack(input.begin(), input.end()), record);
+        break;
+    }
+}
+
+} // namespace gateway
+} // namespace tinymq
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace tinymq {
+namespace gateway {
+
+// Topic and data of one device line. After the fast path the views point
+// into the line itself; after the fallback they point into the storage
+// members, so a record must not be copied while in use.
+struct SensorRecord {
+    std::string_view topic;
+    std::string_view data;
+    std::string topic_storage;
+    std::string data_storage;
+};
+
+enum class RecordEncoding {
+    json,       // One object per line
+    cbor,       // Length-prefixed binary frames, see read_frame_length()
+    msgpack
+};
+
+// Scans {"topic": "...", "data": "..."} in place, in either key order and
+// with any JSON whitespace. Returns false, leaving the record unspecified,
+// for anything else: other keys, non-string values, escapes, control or
+// non-ASCII characters, or malformed input.
+bool parse_record_fast(std::string_view line, SensorRecord& record);
+
+// Decodes a two-entry CBOR or MessagePack map of "topic" and "data" in
+// place. Both must be definite-length strings, except that data may also be
+// a byte string. Returns false for anything else.
+bool parse_record_cbor_fast(std::string_view frame, SensorRecord& record);
+bool parse_record_msgpack_fast(std::string_view frame, SensorRecord& record);
+
+// Fast path with a full parse as fallback, in which data that is neither a
+// string nor bytes becomes its JSON text. Throws std::exception if the input
+// is not a map with a string "topic" and a "data" member.
+void parse_record(std::string_view input, SensorRecord& record,
+                  RecordEncoding encoding = RecordEncoding::json);
+
+// Binary frames are a 16-bit big-endian length followed by the encoded map
+constexpr size_t frame_header_length = 2;
+
+inline size_t read_frame_length(const char* header) {
+    return (static_cast<size_t>(static_cast<unsigned char>(header[0])) << 8) |
+           static_cast<unsigned char>(header[1]);
+}
+
+} // namespace gateway
+} // namespace tinymq
@@ -0,0 +1,389 @@
+#include "spool.h"
+#include <boost/crc.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tinymq {
+namespace gateway {
+
+namespace {
+
+constexpr size_t record_header_length = 8;  // u32 payload length, u32 crc32 of the payload
+
+uint32_t checksum(const uint8_t* data, size_t length) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, length);
+    return crc.checksum();
+}
+
+void put_u32(uint8_t* out, uint32_t value) {
+    out[0] = static_cast<uint8_t>(value >> 24);
+    out[1] = static_cast<uint8_t>(value >> 16);
+    out[2] = static_cast<uint8_t>(value >> 8);
+    out[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t get_u32(const uint8_t* in) {
+    return (static_cast<uint32_t>(in[0]) << 24) | (static_cast<uint32_t>(in[1]) << 16) |
+           (static_cast<uint32_t>(in[2]) << 8) | static_cast<uint32_t>(in[3]);
+}
+
+bool read_exact(int fd, uint8_t* out, size_t length, uint64_t offset) {
+    while (length > 0) {
+        ssize_t n = ::pread(fd, out, length, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        out += n;
+        offset += static_cast<uint64_t>(n);
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = ::write(fd, data, length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        length -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+uint64_t file_size(const std::string& path) {
+    struct stat info;
+    return ::stat(path.c_str(), &info) == 0 ? static_cast<uint64_t>(info.st_size) : 0;
+}
+
+// Makes a rename or a new file in the directory durable
+void sync_directory(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        ::fsync(fd);
+        ::close(fd);
+    }
+}
+
+std::runtime_error spool_error(const std::string& what, const std::string& path) {
+    return std::runtime_error("Spool: " + what + " " + path + ": " + std::strerror(errno));
+}
+
+// Reads the record at offset; returns its total length, or 0 if there is no
+// complete, intact record there
+uint64_t read_record(int fd, uint64_t offset, std::vector<uint8_t>& payload) {
+    uint8_t header[record_header_length];
+    if (!read_exact(fd, header, sizeof(header), offset)) {
+        return 0;
+    }
+    uint32_t length = get_u32(header);
+    if (length == 0 || length > (1u << 24)) {
+        return 0;
+    }
+    payload.resize(length);
+    if (!read_exact(fd, payload.data(), length, offset + record_header_length) ||
+        checksum(payload.data(), length) != get_u32(header + 4) ||
+        static_cast<size_t>(payload[0]) + 1 > length) {
+        return 0;
+    }
+    return record_header_length + length;
+}
+
+} // namespace
+
+Spool::Spool(SpoolOptions options) : options_(std::move(options)) {
+    std::error_code ec;
+    std::filesystem::create_directories(options_.directory, ec);
+    if (ec) {
+        throw std::runtime_error("Spool: cannot create " + options_.directory + ": " + ec.message());
+    }
+
+    for (const auto& entry : std::filesystem::directory_iterator(options_.directory)) {
+        if (entry.path().extension() == ".seg") {
+            try {
+                segments_.push_back(std::stoull(entry.path().stem().string()));
+            } catch (const std::exception&) {
+                // Not one of ours
+            }
+        }
+    }
+    std::sort(segments_.begin(), segments_.end());
+
+    std::ifstream position(position_path());
+    position >> read_position_.segment >> read_position_.offset;
+    if (!position) {
+        read_position_ = SpoolPosition();
+    }
+
+    // Segments before the read position were fully delivered
+    while (!segments_.empty() && segments_.front() < read_position_.segment) {
+        std::filesystem::remove(segment_path(segments_.front()), ec);
+        segments_.erase(segments_.begin());
+    }
+    if (segments_.empty()) {
+        segments_.push_back(std::max<uint64_t>(read_position_.segment, 1));
+    }
+    if (read_position_.segment != segments_.front()) {
+        read_position_ = {segments_.front(), 0};
+    }
+
+    for (size_t i = 0; i + 1 < segments_.size(); ++i) {
+        total_bytes_ += file_size(segment_path(segments_[i]));
+    }
+    uint64_t last_size = recover_segment(segments_.back());
+    total_bytes_ += last_size;
+
+    // A position saved past the records that survived would hide new appends
+    // below it; restart from the end of what is there
+    uint64_t read_segment_size = read_position_.segment == segments_.back()
+                                     ? last_size
+                                     : file_size(segment_path(read_position_.segment));
+    read_position_.offset = std::min(read_position_.offset, read_segment_size);
+
+    open_write_segment(segments_.back());
+    write_offset_ = last_size;
+}
+
+Spool::~Spool() {
+    if (write_fd_ >= 0) {
+        sync();
+        ::close(write_fd_);
+    }
+}
+
+std::string Spool::segment_path(uint64_t segment) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llu.seg", static_cast<unsigned long long>(segment));
+    return options_.directory + "/" + name;
+}
+
+std::string Spool::position_path() const {
+    return options_.directory + "/read.pos";
+}
+
+void Spool::open_write_segment(uint64_t segment) {
+    std::string path = segment_path(segment);
+    write_fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (write_fd_ < 0) {
+        throw spool_error("cannot open", path);
+    }
+    if (segments_.back() != segment) {
+        segments_.push_back(segment);
+    }
+    write_offset_ = 0;
+}
+
+// Cuts the newest segment after its last intact record, which removes a
+// record torn by a crash mid-append
+uint64_t Spool::recover_segment(uint64_t segment) {
+    std::string path = segment_path(segment);
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    uint64_t offset = 0;
+    std::vector<uint8_t> payload;
+    while (uint64_t length = read_record(fd, offset, payload)) {
+        offset += length;
+    }
+    if (offset < file_size(path)) {
+        if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            ::close(fd);
+            throw spool_error("cannot truncate", path);
+        }
+    }
+    ::close(fd);
+    return offset;
+}
+
+bool Spool::append(std::string_view topic, std::string_view data) {
+    if (topic.size() > 255) {
+        return false;
+    }
+
+    size_t payload_length = 1 + topic.size() + data.size();
+    std::vector<uint8_t> record(record_header_length + payload_length);
+    uint8_t* payload = record.data() + record_header_length;
+    payload[0] = static_cast<uint8_t>(topic.size());
+    std::memcpy(payload + 1, topic.data(), topic.size());
+    std::memcpy(payload + 1 + topic.size(), data.data(), data.size());
+    put_u32(record.data(), static_cast<uint32_t>(payload_length));
+    put_u32(record.data() + 4, checksum(payload, payload_length));
+
+    // write_fd_ is closed only when a rollover failed; it is retried here
+    if (write_fd_ < 0 || (write_offset_ > 0 && write_offset_ + record.size() > options_.segment_bytes)) {
+        if (write_fd_ >= 0) {
+            sync();
+            ::close(write_fd_);
+            write_fd_ = -1;
+        }
+        try {
+            open_write_segment(segments_.back() + 1);
+        } catch (const std::runtime_error&) {
+            return false;
+        }
+        sync_directory(options_.directory);
+    }
+
+    // A failed append (e.g. ENOSPC) may leave part of the record behind; cut it
+    // off, or later records would land after a torn one and never be read
+    if (torn_) {
+        if (::ftruncate(write_fd_, static_cast<off_t>(write_offset_)) != 0) {
+            return false;
+        }
+        torn_ = false;
+    }
+    if (!write_all(write_fd_, record.data(), record.size())) {
+        torn_ = ::ftruncate(write_fd_, static_cast<off_t>(write_offset_)) != 0;
+        return false;
+    }
+    write_offset_ += record.size();
+    total_bytes_ += record.size();
+    dirty_ = true;
+
+    while (total_bytes_ > options_.max_bytes && segments_.size() > 1) {
+        drop_oldest_segment();
+    }
+    return true;
+}
+
+void Spool::drop_oldest_segment() {
+    uint64_t segment = segments_.front();
+    std::string path = segment_path(segment);
+    uint64_t size = file_size(path);
+
+    if (read_position_.segment <= segment) {
+        dropped_bytes_ += size - std::min(size, read_position_.offset);
+        read_position_ = {segments_[1], 0};
+        sync();
+        persist_position();
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+    total_bytes_ -= std::min(total_bytes_, size);
+    segments_.erase(segments_.begin());
+}
+
+size_t Spool::read_batch(size_t max_records, std::vector<SpoolRecord>& records, SpoolPosition& next) {
+    records.clear();
+    SpoolPosition position = read_position_;
+    int fd = -1;
+    uint64_t fd_segment = 0;
+    uint64_t segment_end = 0;
+    std::vector<uint8_t> payload;
+
+    while (records.size() < max_records) {
+        bool last = position.segment == segments_.back();
+        if (fd < 0 || fd_segment != position.segment) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            std::string path = segment_path(position.segment);
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            fd_segment = position.segment;
+            segment_end = last ? write_offset_ : file_size(path);
+        }
+
+        uint64_t length = 0;
+        if (fd >= 0 && position.offset < segment_end) {
+            length = read_record(fd, position.offset, payload);
+        }
+        if (length == 0) {
+            // End of a finished segment, or an unreadable rest of it
+            if (last) {
+                break;
+            }
+            auto it = std::upper_bound(segments_.begin(), segments_.end(), position.segment);
+            position = {*it, 0};
+            if (records.empty()) {
+                read_position_ = position;
+            }
+            continue;
+        }
+
+        SpoolRecord record;
+        size_t topic_length = payload[0];
+        record.topic.assign(reinterpret_cast<const char*>(payload.data() + 1), topic_length);
+        record.data.assign(reinterpret_cast<const char*>(payload.data() + 1 + topic_length),
+                           payload.size() - 1 - topic_length);
+        records.push_back(std::move(record));
+        position.offset += length;
+    }
+
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    next = position;
+    return records.size();
+}
+
+void Spool::commit(const SpoolPosition& next) {
+    // A batch read before drop_oldest_segment() moved the position past it
+    // must not move the position back into a deleted segment
+    if (next.segment < read_position_.segment ||
+        (next.segment == read_position_.segment && next.offset < read_position_.offset)) {
+        return;
+    }
+    read_position_ = next;
+
+    std::error_code ec;
+    while (segments_.size() > 1 && segments_.front() < read_position_.segment) {
+        std::string path = segment_path(segments_.front());
+        total_bytes_ -= std::min(total_bytes_, file_size(path));
+        std::filesystem::remove(path, ec);
+        segments_.erase(segments_.begin());
+    }
+
+    // The position must not reach disk ahead of the records it covers
+    sync();
+    persist_position();
+}
+
+void Spool::persist_position() {
+    std::string path = position_path();
+    std::string temporary = path + ".tmp";
+    std::string contents = std::to_string(read_position_.segment) + " " + std::to_string(read_position_.offset) + "\n";
+
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    bool written = write_all(fd, reinterpret_cast<const uint8_t*>(contents.data()), contents.size()) &&
+                   ::fsync(fd) == 0;
+    ::close(fd);
+    if (written && std::rename(temporary.c_str(), path.c_str()) == 0) {
+        sync_directory(options_.directory);
+    }
+}
+
+void Spool::sync() {
+    if (dirty_ && write_fd_ >= 0) {
+        ::fdatasync(write_fd_);
+        dirty_ = false;
+    }
+}
+
+bool Spool::empty() const {
+    return read_position_.segment == segments_.back() && read_position_.offset >= write_offset_;
+}
+
+} // namespace gateway
+} // namespace tinymq
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tinymq {
+namespace gateway {
+
+struct SpoolOptions {
+    std::string directory;
+    uint64_t max_bytes = 256ull << 20;     // Oldest segments are dropped beyond this
+    uint64_t segment_bytes = 4ull << 20;
+};
+
+struct SpoolRecord {
+    std::string topic;
+    std::string data;
+};
+
+struct SpoolPosition {
+    uint64_t segment = 0;
+    uint64_t offset = 0;
+};
+
+// Bounded append-only store for readings that could not be sent. Records go
+// to numbered segment files as [length][crc32][topic length][topic][data];
+// the read position lives in a separate file that is replaced atomically on
+// commit. After a crash, records past the last commit are read again, and a
+// torn record at the end of the newest segment is cut off. Delivery is
+// therefore at least once.
+//
+// Not thread-safe. Throws std::runtime_error if the directory cannot be used.
+class Spool {
+public:
+    explicit Spool(SpoolOptions options);
+    ~Spool();
+
+    Spool(const Spool&) = delete;
+    Spool& operator=(const Spool&) = delete;
+
+    // Returns false if the record could not be stored, e.g. on a full disk or
+    // a failed rollover; the spool stays usable
+    bool append(std::string_view topic, std::string_view data);
+
+    // Reads up to max_records from the read position without consuming them;
+    // next is where reading continues once they are committed
+    size_t read_batch(size_t max_records, std::vector<SpoolRecord>& records, SpoolPosition& next);
+    // Positions behind the current one are ignored; dropping the oldest
+    // segment can move the read position past a batch still being delivered
+    void commit(const SpoolPosition& next);
+
+    // Flushes appended records to the device
+    void sync();
+
+    bool empty() const;
+    uint64_t size_bytes() const { return total_bytes_; }
+    uint64_t dropped_bytes() const { return dropped_bytes_; }
+
+private:
+    std::string segment_path(uint64_t segment) const;
+    std::string position_path() const;
+    void open_write_segment(uint64_t segment);
+    uint64_t recover_segment(uint64_t segment);
+    void drop_oldest_segment();
+    void persist_position();
+
+    SpoolOptions options_;
+    std::vector<uint64_t> segments_;        // Oldest first; the last one is written to
+    SpoolPosition read_position_;
+    int write_fd_ = -1;
+    uint64_t write_offset_ = 0;
+    uint64_t total_bytes_ = 0;
+    uint64_t dropped_bytes_ = 0;
+    bool dirty_ = false;
+    bool torn_ = false;                     // A failed append could not be cut off yet
+};
+
+} // namespace gateway
+} // namespace tinymq
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace tinymq {
+namespace client {
+
+// Maps topic filters to handlers. Filters are '/'-separated levels where '+'
+// matches exactly one level and a trailing '#' matches any number of
+// remaining levels, including none. When several filters match a topic the
+// most specific wins, compared level by level: a literal level beats '+',
+// which beats '#'. Resolutions are cached per concrete topic until the set
+// of filters changes.
+//
+// Not thread-safe; the client only touches it on its strand.
+template <typename T>
+class TopicRouter {
+public:
+    static bool is_wildcard(std::string_view filter) {
+        return filter.find_first_of("+#") != std::string_view::npos;
+    }
+
+    static bool is_valid_filter(std::string_view filter) {
+        size_t start = 0;
+        while (true) {
+            size_t end = filter.find('/', start);
+            std::string_view level = filter.substr(start, end == std::string_view::npos ? end : end - start);
+            if (level.size() > 1 && level.find_first_of("+#") != std::string_view::npos) {
+                return false;
+            }
+            if (level == "#" && end != std::string_view::npos) {
+                return false;
+            }
+            if (end == std::string_view::npos) {
+                return true;
+            }
+            start = end + 1;
+        }
+    }
+
+    void insert(const std::string& filter, T value) {
+        if (is_wildcard(filter)) {
+            Node* node = &root_;
+            for_each_level(filter, [&node](std::string_view level) {
+                auto it = node->children.find(level);
+                if (it == node->children.end()) {
+                    it = node->children.emplace(std::string(level), std::make_unique<Node>()).first;
+                }
+                node = it->second.get();
+            });
+            if (!node->value) {
+                ++wildcards_;
+            }
+            node->value = std::move(value);
+        } else {
+            exact_[filter] = std::move(value);
+        }
+        cache_.clear();
+    }
+
+    bool erase(const std::string& filter) {
+        bool erased = false;
+        if (is_wildcard(filter)) {
+            erased = erase_node(root_, filter, 0);
+            if (erased) {
+                --wildcards_;
+            }
+        } else {
+            erased = exact_.erase(filter) > 0;
+        }
+        cache_.clear();
+        return erased;
+    }
+
+    void clear() {
+        exact_.clear();
+        root_.children.clear();
+        root_.value.reset();
+        wildcards_ = 0;
+        cache_.clear();
+    }
+
+    // The returned pointer stays valid until the next insert, erase or clear
+    const T* match(std::string_view topic) {
+        key_.assign(topic.data(), topic.size());
+        auto exact = exact_.find(key_);
+        if (exact != exact_.end()) {
+            return &exact->second;
+        }
+        if (wildcards_ == 0) {
+            return nullptr;
+        }
+
+        auto cached = cache_.find(key_);
+        if (cached != cache_.end()) {
+            return cached->second;
+        }
+
+        levels_.clear();
+        for_each_level(topic, [this](std::string_view level) { levels_.push_back(level); });
+        // By convention wildcards do not match system topics such as $SYS/...
+        const T* value = topic.empty() || topic[0] == '$' ? nullptr : match_node(root_, 0);
+
+        if (cache_.size() >= max_cached_topics) {
+            cache_.clear();
+        }
+        cache_.emplace(key_, value);
+        return value;
+    }
+
+    std::vector<std::string> filters() const {
+        std::vector<std::string> result;
+        result.reserve(exact_.size() + wildcards_);
+        for (const auto& entry : exact_) {
+            result.push_back(entry.first);
+        }
+        std::string prefix;
+        collect_filters(root_, prefix, result);
+        return result;
+    }
+
+    size_t size() const { return exact_.size() + wildcards_; }
+
+    static constexpr size_t max_cached_topics = size_t(1) << 20;
+
+private:
+    struct Node {
+        std::map<std::string, std::unique_ptr<Node>, std::less<>> children;
+        std::optional<T> value;
+    };
+
+    template <typename Visitor>
+    static void for_each_level(std::string_view topic, Visitor visit) {
+        size_t start = 0;
+        while (true) {
+            size_t end = topic.find('/', start);
+            if (end == std::string_view::npos) {
+                visit(topic.substr(start));
+                return;
+            }
+            visit(topic.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+
+    const T* match_node(const Node& node, size_t depth) const {
+        if (depth == levels_.size()) {
+            if (node.value) {
+                return &*node.value;
+            }
+            auto hash = node.children.find(std::string_view("#"));
+            return hash != node.children.end() && hash->second->value ? &*hash->second->value : nullptr;
+        }
+
+        auto literal = node.children.find(levels_[depth]);
+        if (literal != node.children.end()) {
+            if (const T* value = match_node(*literal->second, depth + 1)) {
+                return value;
+            }
+        }
+        auto plus = node.children.find(std::string_view("+"));
+        if (plus != node.children.end()) {
+            if (const T* value = match_node(*plus->second, depth + 1)) {
+                return value;
+            }
+        }
+        auto hash = node.children.find(std::string_view("#"));
+        if (hash != node.children.end() && hash->second->value) {
+            return &*hash->second->value;
+        }
+        return nullptr;
+    }
+
+    // Returns true if the filter was found; prunes nodes left empty
+    static bool erase_node(Node& node, std::string_view filter, size_t start) {
+        size_t end = filter.find('/', start);
+        std::string_view level = filter.substr(start, end == std::string_view::npos ? end : end - start);
+        auto it = node.children.find(level);
+        if (it == node.children.end()) {
+            return false;
+        }
+
+        Node& child = *it->second;
+        bool erased = false;
+        if (end == std::string_view::npos) {
+            erased = child.value.has_value();
+            child.value.reset();
+        } else {
+            erased = erase_node(child, filter, end + 1);
+        }
+
+        if (!child.value && child.children.empty()) {
+            node.children.erase(it);
+        }
+        return erased;
+    }
+
+    static void collect_filters(const Node& node, std::string& prefix, std::vector<std::string>& result) {
+        for (const auto& entry : node.children) {
+            size_t length = prefix.size();
+            prefix += entry.first;
+            if (entry.second->value) {
+                result.push_back(prefix);
+            }
+            prefix += '/';
+            collect_filters(*entry.second, prefix, result);
+            prefix.resize(length);
+        }
+    }
+
+    std::unordered_map<std::string, T> exact_;
+    Node root_;
+    size_t wildcards_ = 0;
+
+    std::unordered_map<std::string, const T*> cache_;
+    std::string key_;
+    std::vector<std::string_view> levels_;
+};
+
+} // namespace client
+} // namespace tinymq
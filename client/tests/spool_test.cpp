@@ -0,0 +1,188 @@
+#include "spool.h"
+#include <gtest/gtest.h>
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using tinymq::gateway::Spool;
+using tinymq::gateway::SpoolOptions;
+using tinymq::gateway::SpoolPosition;
+using tinymq::gateway::SpoolRecord;
+
+namespace {
+
+class SpoolTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        directory_ = std::filesystem::temp_directory_path() /
+                     ("tinymq-spool-test-" + std::to_string(::getpid()) + "-" +
+                      ::testing::UnitTest::GetInstance()->current_test_info()->name());
+        std::filesystem::remove_all(directory_);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(directory_);
+    }
+
+    SpoolOptions options(uint64_t segment_bytes = 4ull << 20, uint64_t max_bytes = 256ull << 20) const {
+        SpoolOptions result;
+        result.directory = directory_.string();
+        result.segment_bytes = segment_bytes;
+        result.max_bytes = max_bytes;
+        return result;
+    }
+
+    std::filesystem::path segment(uint64_t number) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "%016llu.seg", static_cast<unsigned long long>(number));
+        return directory_ / name;
+    }
+
+    // Reads and commits everything left, returning the data in order
+    static std::vector<std::string> drain(Spool& spool) {
+        std::vector<std::string> data;
+        std::vector<SpoolRecord> batch;
+        SpoolPosition next;
+        while (spool.read_batch(16, batch, next) > 0) {
+            for (const auto& record : batch) {
+                data.push_back(record.data);
+            }
+            spool.commit(next);
+        }
+        return data;
+    }
+
+    std::filesystem::path directory_;
+};
+
+TEST_F(SpoolTest, RecoveryCutsTornTail) {
+    uint64_t intact_size;
+    {
+        Spool spool(options());
+        ASSERT_TRUE(spool.append("t", "one"));
+        ASSERT_TRUE(spool.append("t", "two"));
+        intact_size = spool.size_bytes();
+    }
+
+    // A crash mid-append leaves a record header and part of its payload
+    {
+        std::ofstream file(segment(1), std::ios::binary | std::ios::app);
+        const char torn[] = {0, 0, 0, 40, 1, 2, 3, 4, 1, 't', 'x'};
+        file.write(torn, sizeof(torn));
+    }
+
+    Spool spool(options());
+    EXPECT_EQ(spool.size_bytes(), intact_size);
+    EXPECT_EQ(std::filesystem::file_size(segment(1)), intact_size);
+    ASSERT_TRUE(spool.append("t", "three"));
+    EXPECT_EQ(drain(spool), (std::vector<std::string>{"one", "two", "three"}));
+    EXPECT_TRUE(spool.empty());
+}
+
+TEST_F(SpoolTest, PositionPastRecoveredEndIsClamped) {
+    {
+        Spool spool(options());
+        ASSERT_TRUE(spool.append("t", "one"));
+        ASSERT_TRUE(spool.append("t", "two"));
+        EXPECT_EQ(drain(spool).size(), 2u);
+    }
+
+    // The position reached disk but the records it covers did not
+    std::filesystem::resize_file(segment(1), 0);
+
+    Spool spool(options());
+    EXPECT_TRUE(spool.empty());
+    ASSERT_TRUE(spool.append("t", "three"));
+    EXPECT_FALSE(spool.empty());
+    EXPECT_EQ(drain(spool), (std::vector<std::string>{"three"}));
+}
+
+TEST_F(SpoolTest, FailedAppendLeavesNoTornBytes) {
+    Spool spool(options());
+    ASSERT_TRUE(spool.append("t", "one"));
+    uint64_t intact_size = std::filesystem::file_size(segment(1));
+
+    // A file size limit just past the first record makes the next write
+    // stop partway, as a full disk would
+    struct rlimit original;
+    ASSERT_EQ(::getrlimit(RLIMIT_FSIZE, &original), 0);
+    auto previous_handler = std::signal(SIGXFSZ, SIG_IGN);
+    struct rlimit limited = original;
+    limited.rlim_cur = intact_size + 5;
+    ASSERT_EQ(::setrlimit(RLIMIT_FSIZE, &limited), 0);
+    bool appended = spool.append("t", std::string(64, 'x'));
+    ::setrlimit(RLIMIT_FSIZE, &original);
+    std::signal(SIGXFSZ, previous_handler);
+
+    EXPECT_FALSE(appended);
+    EXPECT_EQ(std::filesystem::file_size(segment(1)), intact_size);
+
+    ASSERT_TRUE(spool.append("t", "two"));
+    EXPECT_EQ(drain(spool), (std::vector<std::string>{"one", "two"}));
+    EXPECT_TRUE(spool.empty());
+}
+
+TEST_F(SpoolTest, FailedRolloverReturnsFalse) {
+    const std::string reading(40, 'r');
+    Spool spool(options(64));
+    ASSERT_TRUE(spool.append("t", reading + "1"));
+
+    // No descriptors left, so the next segment cannot be opened
+    struct rlimit original;
+    ASSERT_EQ(::getrlimit(RLIMIT_NOFILE, &original), 0);
+    struct rlimit limited = original;
+    limited.rlim_cur = 0;
+    ASSERT_EQ(::setrlimit(RLIMIT_NOFILE, &limited), 0);
+    bool appended = spool.append("t", reading + "2");
+    ::setrlimit(RLIMIT_NOFILE, &original);
+
+    EXPECT_FALSE(appended);
+    ASSERT_TRUE(spool.append("t", reading + "3"));
+    EXPECT_EQ(drain(spool), (std::vector<std::string>{reading + "1", reading + "3"}));
+    EXPECT_TRUE(spool.empty());
+}
+
+TEST_F(SpoolTest, CommitBehindDroppedSegmentIsIgnored) {
+    // Each record fills a segment, and only two segments fit
+    const std::string reading(40, 'r');
+    Spool spool(options(64, 128));
+    ASSERT_TRUE(spool.append("t", reading + "1"));
+    ASSERT_TRUE(spool.append("t", reading + "2"));
+
+    std::vector<SpoolRecord> batch;
+    SpoolPosition batch_end;
+    ASSERT_EQ(spool.read_batch(16, batch, batch_end), 2u);
+
+    // While the batch is in flight, new readings push out the oldest segments
+    ASSERT_TRUE(spool.append("t", reading + "3"));
+    ASSERT_TRUE(spool.append("t", reading + "4"));
+    EXPECT_FALSE(std::filesystem::exists(segment(1)));
+    EXPECT_FALSE(std::filesystem::exists(segment(2)));
+
+    spool.commit(batch_end);
+
+    // The persisted position still names a live segment
+    uint64_t position_segment = 0;
+    uint64_t position_offset = 0;
+    std::ifstream(directory_ / "read.pos") >> position_segment >> position_offset;
+    EXPECT_TRUE(std::filesystem::exists(segment(position_segment)));
+
+    // Reading 3 was never delivered, so losing it counts as dropped
+    uint64_t dropped = spool.dropped_bytes();
+    uint64_t third_size = std::filesystem::file_size(segment(3));
+    ASSERT_TRUE(spool.append("t", reading + "5"));
+    EXPECT_EQ(spool.dropped_bytes(), dropped + third_size);
+
+    EXPECT_EQ(drain(spool), (std::vector<std::string>{reading + "4", reading + "5"}));
+    EXPECT_TRUE(spool.empty());
+
+    // The committed position survives a restart
+    Spool reopened(options(64, 128));
+    EXPECT_TRUE(reopened.empty());
+}
+
+} // namespace
@@ -0,0 +1,73 @@
+#include "admission.h"
+#include <algorithm>
+
+namespace tinymq {
+
+namespace {
+// How long to back off while the handshake cap is saturated.
+constexpr auto handshake_retry_interval = std::chrono::milliseconds(5);
+}
+
+AdmissionController::AdmissionController(const AdmissionLimits& limits)
+    : limits_(limits),
+      tokens_(static_cast<double>(std::max<size_t>(limits.accept_burst, 1))),
+      last_refill_(clock::now()) {
+}
+
+void AdmissionController::refill(clock::time_point now) {
+    std::chrono::duration<double> elapsed = now - last_refill_;
+    last_refill_ = now;
+    double capacity = static_cast<double>(std::max<size_t>(limits_.accept_burst, 1));
+    tokens_ = std::min(capacity, tokens_ + elapsed.count() * limits_.accept_rate);
+}
+
+AdmissionController::clock::duration AdmissionController::accept_delay() {
+    if (limits_.max_handshakes > 0 &&
+        pending_handshakes_.load(std::memory_order_relaxed) >= limits_.max_handshakes) {
+        return handshake_retry_interval;
+    }
+
+    if (limits_.accept_rate <= 0.0) {
+        return clock::duration::zero();
+    }
+
+    std::lock_guard<std::mutex> lock(bucket_mutex_);
+    refill(clock::now());
+    if (tokens_ >= 1.0) {
+        return clock::duration::zero();
+    }
+
+    std::chrono::duration<double> wait((1.0 - tokens_) / limits_.accept_rate);
+    return std::chrono::duration_cast<clock::duration>(wait);
+}
+
+bool AdmissionController::admit() {
+    if (limits_.max_sessions > 0 &&
+        active_sessions_.load(std::memory_order_relaxed) >= limits_.max_sessions) {
+        refused_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (limits_.accept_rate > 0.0) {
+        std::lock_guard<std::mutex> lock(bucket_mutex_);
+        refill(clock::now());
+        tokens_ = std::max(0.0, tokens_ - 1.0);
+    }
+
+    active_sessions_.fetch_add(1, std::memory_order_relaxed);
+    pending_handshakes_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void AdmissionController::handshake_completed() {
+    pending_handshakes_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void AdmissionController::session_closed(bool handshake_pending) {
+    if (handshake_pending) {
+        pending_handshakes_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    active_sessions_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+} // namespace tinymq
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace tinymq {
+
+// Limits applied by the broker before a new connection becomes a Session.
+// A value of zero disables the corresponding limit. All are off by default
+// except handshake_timeout, which drops connections that send no CONN
+// within 10 seconds.
+struct AdmissionLimits {
+    size_t max_sessions = 0;                        // Concurrent sessions (handshaking or connected)
+    double accept_rate = 0.0;                       // Accepted connections per second
+    size_t accept_burst = 64;                       // Token bucket capacity
+    size_t max_handshakes = 0;                      // Sessions that have not sent CONN yet
+    std::chrono::milliseconds handshake_timeout{10000};
+};
+
+class AdmissionController {
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit AdmissionController(const AdmissionLimits& limits = {});
+
+    // Time to wait before the next accept may proceed; zero means accept now.
+    clock::duration accept_delay();
+
+    // Called once per accepted socket. Returns false if the connection must be refused.
+    bool admit();
+
+    void handshake_completed();
+    void session_closed(bool handshake_pending);
+
+    const AdmissionLimits& limits() const { return limits_; }
+    size_t active_sessions() const { return active_sessions_.load(std::memory_order_relaxed); }
+    size_t pending_handshakes() const { return pending_handshakes_.load(std::memory_order_relaxed); }
+    size_t refused() const { return refused_.load(std::memory_order_relaxed); }
+
+private:
+    void refill(clock::time_point now);
+
+    AdmissionLimits limits_;
+    std::mutex bucket_mutex_;
+    double tokens_;
+    clock::time_point last_refill_;
+    std::atomic<size_t> active_sessions_{0};
+    std::atomic<size_t> pending_handshakes_{0};
+    std::atomic<size_t> refused_{0};
+};
+
+} // namespace tinymq
@@ -2,13 +2,56 @@
 #include "session.h"
 #include "terminal_ui.h"
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
+#include <sys/stat.h>
 
 namespace tinymq {
 
-Broker::Broker(uint16_t port, size_t thread_pool_size)
-    : io_context_(),
+namespace {
+
+// Removes a socket file only when nothing listens on it any more, so a second
+// broker fails to bind instead of taking over a live broker's path
+void remove_stale_socket(const std::string& path) {
+    std::error_code ec;
+    if (!std::filesystem::is_socket(path, ec)) {
+        return;
+    }
+    boost::asio::io_context probe_context;
+    boost::asio::local::stream_protocol::socket probe(probe_context);
+    boost::system::error_code connect_ec;
+    probe.connect(boost::asio::local::stream_protocol::endpoint(path), connect_ec);
+    if (connect_ec == boost::asio::error::connection_refused) {
+        std::filesystem::remove(path, ec);
+    }
+}
+
+Broker::SocketFile bound_socket(const std::string& path) {
+    struct stat info;
+    if (::stat(path.c_str(), &info) != 0) {
+        return {path, 0, 0};
+    }
+    return {path, static_cast<uint64_t>(info.st_dev), static_cast<uint64_t>(info.st_ino)};
+}
+
+// Removes the socket file on shutdown unless another broker has since replaced it
+void remove_bound_socket(const Broker::SocketFile& file) {
+    struct stat info;
+    if (::stat(file.path.c_str(), &info) == 0 && static_cast<uint64_t>(info.st_dev) == file.device &&
+        static_cast<uint64_t>(info.st_ino) == file.inode) {
+        std::error_code ec;
+        std::filesystem::remove(file.path, ec);
+    }
+}
+
+} // namespace
+
+Broker::Broker(uint16_t port, size_t thread_pool_size, const AdmissionLimits& admission_limits)
+    : admission_(admission_limits),
+      io_context_(),
       acceptor_(io_context_, boost::asio::ip::tcp::endpoint(boost::asio::ip::tcp::v4(), port)),
+      accept_timer_(io_context_),
+      local_accept_timer_(io_context_),
       thread_pool_size_(thread_pool_size),
       running_(false) {
 }
@@ -24,7 +67,35 @@ void Broker::start() {
     
     running_ = true;
     
-    accept_connections();
+    if (uring_) {
+        uring_->start();
+        accept_connections(*uring_acceptor_, accept_timer_);
+        ui::print_message("Broker", "Serving TCP sessions through io_uring", ui::MessageType::INFO);
+    } else {
+        accept_connections(acceptor_, accept_timer_);
+    }
+    if (local_acceptor_) {
+        accept_connections(*local_acceptor_, local_accept_timer_);
+        ui::print_message("Broker", "Accepting local connections on " + local_socket_.path, ui::MessageType::INFO);
+    }
+    
+    if (metrics_server_) {
+        metrics_server_->start();
+        ui::print_message("Broker", "Metrics available at http://127.0.0.1:" + 
+                         std::to_string(metrics_server_->port()) + "/metrics", ui::MessageType::INFO);
+    }
+    
+    if (udp_listener_) {
+        udp_listener_->start();
+        ui::print_message("Broker", "Accepting PUB datagrams on UDP port " + 
+                         std::to_string(udp_listener_->port()), ui::MessageType::INFO);
+    }
+    
+    if (shm_listener_) {
+        shm_listener_->start();
+        ui::print_message("Broker", "Accepting shared memory sessions via " + 
+                         shm_listener_->path(), ui::MessageType::INFO);
+    }
     
     threads_.reserve(thread_pool_size_);
     for (size_t i = 0; i < thread_pool_size_; ++i) {
@@ -49,7 +120,27 @@ void Broker::stop() {
     
     running_ = false;
     
+    if (uring_acceptor_) {
+        uring_acceptor_->close();
+    }
     acceptor_.close();
+    accept_timer_.cancel();
+    if (local_acceptor_) {
+        boost::system::error_code ec;
+        local_acceptor_->close(ec);
+        local_accept_timer_.cancel();
+        remove_bound_socket(local_socket_);
+    }
+    if (metrics_server_) {
+        metrics_server_->stop();
+    }
+    if (udp_listener_) {
+        udp_listener_->stop();
+    }
+    if (shm_listener_) {
+        shm_listener_->stop();
+        remove_bound_socket(shm_socket_);
+    }
     
     io_context_.stop();
     
@@ -69,25 +160,95 @@ void Broker::stop() {
         topic_subscribers_.clear();
     }
     
+    if (uring_) {
+        uring_->stop();
+    }
+    
     threads_.clear();
     
     ui::print_message("Broker", "Stopped", ui::MessageType::INFO);
 }
 
-void Broker::accept_connections() {
-    acceptor_.async_accept(
-        [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+void Broker::enable_metrics(uint16_t port) {
+    metrics_server_ = std::make_unique<MetricsServer>(io_context_, port, *this);
+}
+
+void Broker::enable_udp(uint16_t port, const std::string& token) {
+    udp_listener_ = std::make_unique<UdpListener>(io_context_, port, *this, token);
+}
+
+void Broker::enable_unix_socket(const std::string& path) {
+    // A previous broker that did not shut down cleanly leaves its socket behind
+    remove_stale_socket(path);
+    
+    local_acceptor_ = std::make_unique<boost::asio::local::stream_protocol::acceptor>(
+        io_context_, boost::asio::local::stream_protocol::endpoint(path));
+    local_socket_ = bound_socket(path);
+}
+
+void Broker::enable_shm(const std::string& path) {
+    remove_stale_socket(path);
+    
+    shm_listener_ = std::make_unique<ShmListener>(io_context_, path, *this);
+    shm_socket_ = bound_socket(path);
+}
+
+bool Broker::enable_io_uring() {
+    try {
+        uring_ = std::make_unique<UringService>(io_context_);
+    } catch (const std::exception& e) {
+        ui::print_message("Broker", "io_uring unavailable, using the reactor: " + std::string(e.what()), ui::MessageType::WARNING);
+        return false;
+    }
+    uring_acceptor_ = std::make_unique<UringAcceptor>(*uring_, acceptor_);
+    return true;
+}
+
+size_t Broker::topic_count() {
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+    size_t count = topic_subscribers_.size();
+    for (const auto& entry : in_process_subscribers_) {
+        if (topic_subscribers_.find(entry.first) == topic_subscribers_.end()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+template <typename Acceptor>
+void Broker::accept_connections(Acceptor& acceptor, boost::asio::steady_timer& timer) {
+    // Leave pending connections in the kernel backlog while the accept budget
+    // is exhausted so that reconnect storms are paced instead of served at once
+    auto delay = admission_.accept_delay();
+    if (delay > AdmissionController::clock::duration::zero()) {
+        timer.expires_after(delay);
+        timer.async_wait([this, &acceptor, &timer](boost::system::error_code ec) {
+            if (!ec && running_) {
+                accept_connections(acceptor, timer);
+            }
+        });
+        return;
+    }
+    
+    acceptor.async_accept(
+        [this, &acceptor, &timer](boost::system::error_code ec, auto socket) {
             if (!ec) {
-                auto session = std::make_shared<Session>(std::move(socket), *this);
-                ui::print_message("Broker", "New connection from " + 
-                                session->remote_endpoint(), ui::MessageType::INCOMING);
-                session->start();
+                if (admission_.admit()) {
+                    auto session = std::make_shared<Session>(std::move(socket), *this);
+                    ui::print_message("Broker", "New connection from " + 
+                                    session->remote_endpoint(), ui::MessageType::INCOMING);
+                    session->start();
+                } else {
+                    // Dropping the socket closes it
+                    ui::print_message("Broker", "Session limit reached, refusing connection", 
+                                    ui::MessageType::WARNING);
+                }
             } else {
                 ui::print_message("Broker", "Accept error: " + ec.message(), ui::MessageType::ERROR);
             }
             
             if (running_) {
-                accept_connections();
+                accept_connections(acceptor, timer);
             }
         });
 }
@@ -139,8 +300,8 @@ void Broker::remove_session(std::shared_ptr<Session> session) {
     
     {
         std::lock_guard<std::mutex> lock(topics_mutex_);
-        for (auto& topic_entry : topic_subscribers_) {
-            auto& subscribers = topic_entry.second;
+        for (auto it = topic_subscribers_.begin(); it != topic_subscribers_.end();) {
+            auto& subscribers = it->second;
             subscribers.erase(
                 std::remove_if(
                     subscribers.begin(),
@@ -149,6 +310,12 @@ void Broker::remove_session(std::shared_ptr<Session> session) {
                         return s == session;
                     }),
                 subscribers.end());
+            
+            if (subscribers.empty()) {
+                it = topic_subscribers_.erase(it);
+            } else {
+                ++it;
+            }
         }
     }
     
@@ -186,8 +353,48 @@ void Broker::unsubscribe(std::shared_ptr<Session> session, const std::string& to
     }
 }
 
-void Broker::publish(const std::string& topic, const std::vector<uint8_t>& message) {
+void Broker::subscribe(std::shared_ptr<InProcessSubscription> subscription, const std::string& topic) {
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+    
+    auto& subscribers = in_process_subscribers_[topic];
+    if (std::find(subscribers.begin(), subscribers.end(), subscription) == subscribers.end()) {
+        subscribers.push_back(std::move(subscription));
+    }
+}
+
+void Broker::unsubscribe(const std::shared_ptr<InProcessSubscription>& subscription, const std::string& topic) {
+    std::lock_guard<std::mutex> lock(topics_mutex_);
+    
+    auto it = in_process_subscribers_.find(topic);
+    if (it != in_process_subscribers_.end()) {
+        auto& subscribers = it->second;
+        subscribers.erase(
+            std::remove(subscribers.begin(), subscribers.end(), subscription),
+            subscribers.end());
+        
+        if (subscribers.empty()) {
+            in_process_subscribers_.erase(it);
+        }
+    }
+}
+
+void Broker::publish(const std::string& topic, const std::vector<uint8_t>& message,
+                     metrics::clock::time_point received_at) {
+    route(topic, message, nullptr, received_at);
+}
+
+void Broker::publish(const std::string& topic, std::shared_ptr<const std::vector<uint8_t>> message) {
+    const auto& bytes = *message;
+    route(topic, bytes, std::move(message), metrics::clock::time_point());
+}
+
+void Broker::route(const std::string& topic, const std::vector<uint8_t>& message,
+                   std::shared_ptr<const std::vector<uint8_t>> shared_message,
+                   metrics::clock::time_point received_at) {
+    // In-process publishes skip the console log, which would cost more than their delivery
+    bool logged = !shared_message;
     std::vector<std::shared_ptr<Session>> subscribers;
+    std::vector<std::shared_ptr<InProcessSubscription>> in_process;
     
     {
         std::lock_guard<std::mutex> lock(topics_mutex_);
@@ -195,17 +402,48 @@ void Broker::publish(const std::string& topic, const std::vector<uint8_t>& messa
         if (it != topic_subscribers_.end()) {
             subscribers = it->second;
         }
+        auto local = in_process_subscribers_.find(topic);
+        if (local != in_process_subscribers_.end()) {
+            in_process = local->second;
+        }
+    }
+    
+    auto routed_at = metrics::clock::now();
+    if (received_at != metrics::clock::time_point()) {
+        metrics::record_latency(metrics::Stage::ReadToRoute, received_at, routed_at);
+    }
+    
+    if (!in_process.empty()) {
+        // Messages from sessions are copied once; shared buffers are handed on as they are
+        if (!shared_message) {
+            shared_message = std::make_shared<const std::vector<uint8_t>>(message);
+        }
+        for (auto& subscription : in_process) {
+            subscription->handler(topic, shared_message);
+        }
+        metrics::add(metrics::Counter::MessagesOut, in_process.size());
     }
     
     if (subscribers.empty()) {
-        ui::print_message("Topic", "No subscribers for topic: " + topic, ui::MessageType::INFO);
+        if (logged && in_process.empty()) {
+            ui::print_message("Topic", "No subscribers for topic: " + topic, ui::MessageType::INFO);
+        }
         return;
     }
     
-    ui::print_message("Topic", "Publishing to " + std::to_string(subscribers.size()) + 
-                   " subscribers on topic: " + topic, ui::MessageType::OUTGOING);
+    if (logged) {
+        ui::print_message("Topic", "Publishing to " + std::to_string(subscribers.size()) + 
+                       " subscribers on topic: " + topic, ui::MessageType::OUTGOING);
+    }
+    
+    // Only in-process publishers can exceed what a PUB frame holds
+    if (topic.size() > 255 || 1 + topic.size() + message.size() > 0xFFFF) {
+        metrics::add(metrics::Counter::Drops, subscribers.size());
+        return;
+    }
     
     std::vector<uint8_t> payload;
+    payload.reserve(1 + topic.size() + message.size());
     
     payload.push_back(static_cast<uint8_t>(topic.size()));
     
@@ -214,9 +452,11 @@ void Broker::publish(const std::string& topic, const std::vector<uint8_t>& messa
     payload.insert(payload.end(), message.begin(), message.end());
     
     Packet packet(PacketType::PUB, 0, payload);
+    auto frame = std::make_shared<const std::vector<uint8_t>>(packet.serialize());
     
     for (auto& subscriber : subscribers) {
-        subscriber->send_packet(packet);
+        subscriber->send_frame(frame);
+        metrics::record_latency(metrics::Stage::RouteToEnqueue, routed_at);
     }
 }
 
@@ -1,47 +1,123 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
+#include "admission.h"
+#include "metrics.h"
+#include "metrics_server.h"
 #include "packet.h"
+#include "shm_listener.h"
+#include "udp_listener.h"
+#include "uring_acceptor.h"
+#include "uring_service.h"
 
 namespace tinymq {
 
 class Session;
 
+// Subscriber in the broker's own process (see InProcessClient); receives the
+// published buffer itself rather than a PUB frame
+struct InProcessSubscription {
+    std::function<void(const std::string& topic, const std::shared_ptr<const std::vector<uint8_t>>& message)> handler;
+};
+
 class Broker {
 public:
-    Broker(uint16_t port = 1505, size_t thread_pool_size = 4);
+    Broker(uint16_t port = 1505, size_t thread_pool_size = 4,
+           const AdmissionLimits& admission_limits = AdmissionLimits());
     
     ~Broker();
     
     void start();
     void stop();
     
+    // Serves Prometheus metrics on 127.0.0.1:port; call before start()
+    void enable_metrics(uint16_t port);
+    
+    // Accepts PUB datagrams on UDP port (see UdpListener); call before start().
+    // A non-empty token is required in every datagram.
+    void enable_udp(uint16_t port, const std::string& token = "");
+    
+    // Also accepts sessions on a Unix domain socket at path, for clients on
+    // the same machine. A stale socket file there is replaced; if a broker
+    // still listens on it, binding throws instead. Call before start().
+    void enable_unix_socket(const std::string& path);
+    
+    // Accepts shared memory sessions (see ShmChannel) from clients that connect
+    // to a Unix domain socket at path. As with enable_unix_socket, only a
+    // stale socket file there is replaced. Call before start().
+    void enable_shm(const std::string& path);
+    
+    // Serves TCP sessions and accepts through io_uring (see UringService)
+    // instead of the reactor. Returns false, leaving the reactor in use, when
+    // the build or the kernel lacks support. Call before start().
+    bool enable_io_uring();
+    
     void register_session(std::shared_ptr<Session> session);
     void remove_session(std::shared_ptr<Session> session);
     
     void subscribe(std::shared_ptr<Session> session, const std::string& topic);
     void unsubscribe(std::shared_ptr<Session> session, const std::string& topic);
-    void publish(const std::string& topic, const std::vector<uint8_t>& message);
+    // received_at, when set, is when the PUB was read and feeds the latency histograms
+    void publish(const std::string& topic, const std::vector<uint8_t>& message,
+                 metrics::clock::time_point received_at = metrics::clock::time_point());
+    
+    // Routes a message that is already in a shared buffer. In-process
+    // subscribers get that buffer; sessions still get a serialized PUB.
+    void publish(const std::string& topic, std::shared_ptr<const std::vector<uint8_t>> message);
+    void subscribe(std::shared_ptr<InProcessSubscription> subscription, const std::string& topic);
+    void unsubscribe(const std::shared_ptr<InProcessSubscription>& subscription, const std::string& topic);
+    
+    AdmissionController& admission() { return admission_; }
+    
+    // A Unix domain socket file this broker bound, identified by inode
+    struct SocketFile {
+        std::string path;
+        uint64_t device = 0;
+        uint64_t inode = 0;
+    };
+    
+    size_t topic_count();
 
 private:
-    void accept_connections();
+    // Paced by the admission controller like TCP; each acceptor has its own timer
+    template <typename Acceptor>
+    void accept_connections(Acceptor& acceptor, boost::asio::steady_timer& timer);
     
     using TopicSubscribers = std::unordered_map<std::string, std::vector<std::shared_ptr<Session>>>;
+    using InProcessSubscribers =
+        std::unordered_map<std::string, std::vector<std::shared_ptr<InProcessSubscription>>>;
+    
+    void route(const std::string& topic, const std::vector<uint8_t>& message,
+               std::shared_ptr<const std::vector<uint8_t>> shared_message,
+               metrics::clock::time_point received_at);
 
+    AdmissionController admission_;  // Must outlive io_context_: sessions report to it on destruction
+    std::unique_ptr<UringService> uring_;  // Must outlive io_context_: streams recycle buffers into it
     boost::asio::io_context io_context_;
     boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::steady_timer accept_timer_;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> local_acceptor_;
+    boost::asio::steady_timer local_accept_timer_;
+    SocketFile local_socket_;
+    std::unique_ptr<MetricsServer> metrics_server_;
+    std::unique_ptr<UdpListener> udp_listener_;
+    std::unique_ptr<ShmListener> shm_listener_;
+    SocketFile shm_socket_;
+    std::unique_ptr<UringAcceptor> uring_acceptor_;
     size_t thread_pool_size_;
     std::vector<std::thread> threads_;
     std::mutex sessions_mutex_;
     std::mutex topics_mutex_;
     std::unordered_map<std::string, std::shared_ptr<Session>> sessions_;  // client_id -> session
     TopicSubscribers topic_subscribers_;
+    InProcessSubscribers in_process_subscribers_;  // Also guarded by topics_mutex_
     bool running_;
 };
 
@@ -0,0 +1,88 @@
+#include "buffer_pool.h"
+#include <array>
+#include <vector>
+
+namespace tinymq {
+
+namespace {
+
+constexpr size_t class_size(size_t size_class) {
+    return size_t(256) << (2 * size_class);
+}
+
+struct ThreadCache {
+    std::array<std::vector<std::unique_ptr<uint8_t[]>>, BufferPool::size_classes> free;
+};
+
+ThreadCache& thread_cache() {
+    thread_local ThreadCache cache;
+    return cache;
+}
+
+} // namespace
+
+PooledBuffer::PooledBuffer(std::unique_ptr<uint8_t[]> data, size_t capacity, size_t size_class)
+    : data_(std::move(data)), capacity_(capacity), size_class_(size_class) {
+}
+
+PooledBuffer::PooledBuffer(PooledBuffer&& other) noexcept
+    : data_(std::move(other.data_)), capacity_(other.capacity_), size_class_(other.size_class_) {
+    other.capacity_ = 0;
+}
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& other) noexcept {
+    if (this != &other) {
+        reset();
+        data_ = std::move(other.data_);
+        capacity_ = other.capacity_;
+        size_class_ = other.size_class_;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+PooledBuffer::~PooledBuffer() {
+    reset();
+}
+
+void PooledBuffer::reset() {
+    if (data_) {
+        BufferPool::release(std::move(data_), size_class_);
+        capacity_ = 0;
+    }
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    size_t size_class = 0;
+    while (size_class + 1 < size_classes && class_size(size_class) < size) {
+        ++size_class;
+    }
+    
+    if (class_size(size_class) < size) {
+        // Larger than any class; allocate exactly and let release() free it
+        return PooledBuffer(std::unique_ptr<uint8_t[]>(new uint8_t[size]), size, size_classes);
+    }
+    
+    auto& free = thread_cache().free[size_class];
+    if (!free.empty()) {
+        auto data = std::move(free.back());
+        free.pop_back();
+        return PooledBuffer(std::move(data), class_size(size_class), size_class);
+    }
+    
+    return PooledBuffer(std::unique_ptr<uint8_t[]>(new uint8_t[class_size(size_class)]),
+                        class_size(size_class), size_class);
+}
+
+void BufferPool::release(std::unique_ptr<uint8_t[]> data, size_t size_class) {
+    if (size_class >= size_classes) {
+        return;
+    }
+    
+    auto& free = thread_cache().free[size_class];
+    if (free.size() < max_cached_per_class) {
+        free.push_back(std::move(data));
+    }
+}
+
+} // namespace tinymq
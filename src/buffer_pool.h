@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace tinymq {
+
+// Move-only handle to a pooled byte buffer. The buffer returns to the pool
+// of whichever thread destroys the handle.
+class PooledBuffer {
+public:
+    PooledBuffer() = default;
+    PooledBuffer(PooledBuffer&& other) noexcept;
+    PooledBuffer& operator=(PooledBuffer&& other) noexcept;
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+    ~PooledBuffer();
+
+    uint8_t* data() const { return data_.get(); }
+    size_t capacity() const { return capacity_; }
+    explicit operator bool() const { return data_ != nullptr; }
+
+    void reset();
+
+private:
+    friend class BufferPool;
+    PooledBuffer(std::unique_ptr<uint8_t[]> data, size_t capacity, size_t size_class);
+
+    std::unique_ptr<uint8_t[]> data_;
+    size_t capacity_ = 0;
+    size_t size_class_ = 0;
+};
+
+// Size-class buffer pool for transient reads. Free buffers are cached per
+// thread, so acquire and release never lock; each class keeps a bounded
+// number of buffers and frees the rest.
+class BufferPool {
+public:
+    static constexpr size_t size_classes = 5;           // 256 B, 1 KiB, 4 KiB, 16 KiB, 64 KiB
+    static constexpr size_t max_cached_per_class = 32;
+
+    static PooledBuffer acquire(size_t size);
+
+private:
+    friend class PooledBuffer;
+    static void release(std::unique_ptr<uint8_t[]> data, size_t size_class);
+};
+
+} // namespace tinymq
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace tinymq {
+namespace metrics {
+
+// Log-linear bucketing in the style of HdrHistogram: values below 16 get
+// their own bucket, larger values are split into 16 sub-buckets per power
+// of two, bounding the relative error to about 6%.
+constexpr unsigned histogram_sub_bits = 4;
+constexpr size_t histogram_sub_buckets = size_t(1) << histogram_sub_bits;
+constexpr size_t histogram_buckets = (64 - histogram_sub_bits + 1) * histogram_sub_buckets;
+
+inline size_t histogram_bucket(uint64_t value) {
+    if (value < histogram_sub_buckets) {
+        return static_cast<size_t>(value);
+    }
+    unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(value));
+    unsigned shift = msb - histogram_sub_bits;
+    return (shift + 1) * histogram_sub_buckets + ((value >> shift) & (histogram_sub_buckets - 1));
+}
+
+// Midpoint of the range of values that map to the bucket
+inline uint64_t histogram_bucket_value(size_t bucket) {
+    if (bucket < histogram_sub_buckets) {
+        return bucket;
+    }
+    unsigned shift = static_cast<unsigned>(bucket / histogram_sub_buckets) - 1;
+    uint64_t sub = bucket % histogram_sub_buckets;
+    uint64_t lower = (histogram_sub_buckets + sub) << shift;
+    return lower + ((uint64_t(1) << shift) >> 1);
+}
+
+// Written by a single thread; see ThreadCounters for the access rules.
+struct Histogram {
+    std::array<std::atomic<uint64_t>, histogram_buckets> buckets;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+
+    void record(uint64_t value) {
+        auto& bucket = buckets[histogram_bucket(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+struct HistogramSnapshot {
+    std::array<uint64_t, histogram_buckets> buckets{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    void merge(const Histogram& histogram) {
+        for (size_t i = 0; i < histogram_buckets; ++i) {
+            buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+        count += histogram.count.load(std::memory_order_relaxed);
+        sum += histogram.sum.load(std::memory_order_relaxed);
+    }
+
+    // quantile in [0, 1]; returns 0 for an empty histogram
+    uint64_t percentile(double quantile) const {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(count));
+        if (rank >= count) {
+            rank = count - 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < histogram_buckets; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return histogram_bucket_value(i);
+            }
+        }
+        return histogram_bucket_value(histogram_buckets - 1);
+    }
+};
+
+} // namespace metrics
+} // namespace tinymq
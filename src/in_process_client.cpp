@@ -0,0 +1,47 @@
+#include "in_process_client.h"
+#include "metrics.h"
+
+namespace tinymq {
+
+InProcessClient::InProcessClient(Broker& broker) : broker_(broker) {
+}
+
+InProcessClient::~InProcessClient() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& entry : subscriptions_) {
+        broker_.unsubscribe(entry.second, entry.first);
+    }
+}
+
+void InProcessClient::publish(const std::string& topic, Message message) {
+    metrics::add(metrics::Counter::MessagesIn);
+    broker_.publish(topic, std::move(message));
+}
+
+void InProcessClient::publish(const std::string& topic, std::vector<uint8_t> message) {
+    publish(topic, std::make_shared<const std::vector<uint8_t>>(std::move(message)));
+}
+
+void InProcessClient::subscribe(const std::string& topic, MessageHandler handler) {
+    auto subscription = std::make_shared<InProcessSubscription>();
+    subscription->handler = std::move(handler);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& current = subscriptions_[topic];
+    if (current) {
+        broker_.unsubscribe(current, topic);
+    }
+    current = subscription;
+    broker_.subscribe(std::move(subscription), topic);
+}
+
+void InProcessClient::unsubscribe(const std::string& topic) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = subscriptions_.find(topic);
+    if (it != subscriptions_.end()) {
+        broker_.unsubscribe(it->second, topic);
+        subscriptions_.erase(it);
+    }
+}
+
+} // namespace tinymq
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "broker.h"
+
+namespace tinymq {
+
+// Client for an application that embeds the broker. Publishes go straight
+// into Broker::publish as shared buffers, with no socket and no framing, and
+// in-process subscribers receive the published buffer itself. Sessions
+// subscribed to the same topic still get an ordinary PUB.
+//
+// Handlers run on the publishing thread, which is a broker thread for
+// messages from network clients, so they must not block. A publish already
+// under way on another thread may still reach a handler just after
+// unsubscribe() returns. Must not outlive the broker.
+class InProcessClient {
+public:
+    using Message = std::shared_ptr<const std::vector<uint8_t>>;
+    using MessageHandler = std::function<void(const std::string& topic, const Message& message)>;
+
+    explicit InProcessClient(Broker& broker);
+    ~InProcessClient();
+
+    InProcessClient(const InProcessClient&) = delete;
+    InProcessClient& operator=(const InProcessClient&) = delete;
+
+    void publish(const std::string& topic, Message message);
+    void publish(const std::string& topic, std::vector<uint8_t> message);
+
+    // Replaces the handler if the topic is already subscribed
+    void subscribe(const std::string& topic, MessageHandler handler);
+    void unsubscribe(const std::string& topic);
+
+private:
+    Broker& broker_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<InProcessSubscription>> subscriptions_;
+};
+
+} // namespace tinymq
@@ -16,6 +16,13 @@ void signal_handler(int signal) {
 int main(int argc, char* argv[]) {
     uint16_t port = 1505;
     size_t thread_pool_size = 4;
+    tinymq::AdmissionLimits admission_limits;
+    uint16_t metrics_port = 0;
+    uint16_t udp_port = 0;
+    std::string udp_token;
+    std::string unix_socket;
+    std::string shm_socket;
+    bool io_uring = false;
     
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -23,12 +30,45 @@ int main(int argc, char* argv[]) {
             port = static_cast<uint16_t>(std::stoi(argv[++i]));
         } else if (arg == "--threads" && i + 1 < argc) {
             thread_pool_size = static_cast<size_t>(std::stoi(argv[++i]));
+        } else if (arg == "--metrics-port" && i + 1 < argc) {
+            metrics_port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--udp-port" && i + 1 < argc) {
+            udp_port = static_cast<uint16_t>(std::stoi(argv[++i]));
+        } else if (arg == "--udp-token" && i + 1 < argc) {
+            udp_token = argv[++i];
+        } else if (arg == "--unix-socket" && i + 1 < argc) {
+            unix_socket = argv[++i];
+        } else if (arg == "--shm-socket" && i + 1 < argc) {
+            shm_socket = argv[++i];
+        } else if (arg == "--io-uring") {
+            io_uring = true;
+        } else if (arg == "--max-sessions" && i + 1 < argc) {
+            admission_limits.max_sessions = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--accept-rate" && i + 1 < argc) {
+            admission_limits.accept_rate = std::stod(argv[++i]);
+        } else if (arg == "--accept-burst" && i + 1 < argc) {
+            admission_limits.accept_burst = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--max-handshakes" && i + 1 < argc) {
+            admission_limits.max_handshakes = static_cast<size_t>(std::stoul(argv[++i]));
+        } else if (arg == "--handshake-timeout" && i + 1 < argc) {
+            admission_limits.handshake_timeout = std::chrono::milliseconds(std::stol(argv[++i]));
         } else if (arg == "--help") {
             std::cout << "TinyMQ Broker" << std::endl;
             std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
             std::cout << "Options:" << std::endl;
             std::cout << "  --port PORT       Set the port number (default: 1505)" << std::endl;
             std::cout << "  --threads N       Set thread pool size (default: 4)" << std::endl;
+            std::cout << "  --metrics-port PORT  Serve Prometheus metrics on 127.0.0.1:PORT (default: off)" << std::endl;
+            std::cout << "  --udp-port PORT   Accept fire-and-forget PUB datagrams on UDP PORT (default: off)" << std::endl;
+            std::cout << "  --udp-token TOKEN  Drop datagrams that do not carry TOKEN (default: none)" << std::endl;
+            std::cout << "  --unix-socket PATH  Also accept local clients on a Unix domain socket (default: off)" << std::endl;
+            std::cout << "  --shm-socket PATH  Accept shared memory sessions set up via PATH (default: off)" << std::endl;
+            std::cout << "  --io-uring        Serve TCP sessions through io_uring (default: off)" << std::endl;
+            std::cout << "  --max-sessions N  Refuse connections beyond N sessions (default: unlimited)" << std::endl;
+            std::cout << "  --accept-rate R   Accept at most R connections per second (default: unlimited)" << std::endl;
+            std::cout << "  --accept-burst N  Accept burst size for --accept-rate (default: 64)" << std::endl;
+            std::cout << "  --max-handshakes N  Pause accepting while N sessions await CONN (default: unlimited)" << std::endl;
+            std::cout << "  --handshake-timeout MS  Close sessions that do not send CONN in time; 0 disables (default: 10000)" << std::endl;
             std::cout << "  --help            Show this help message" << std::endl;
             return 0;
         }
@@ -41,9 +81,25 @@ int main(int argc, char* argv[]) {
         tinymq::ui::print_message("Config", "Thread pool size: " + std::to_string(thread_pool_size), 
                                  tinymq::ui::MessageType::INFO);
         
-        tinymq::Broker broker(port, thread_pool_size);
+        tinymq::Broker broker(port, thread_pool_size, admission_limits);
         g_broker = &broker;
         
+        if (metrics_port != 0) {
+            broker.enable_metrics(metrics_port);
+        }
+        if (udp_port != 0) {
+            broker.enable_udp(udp_port, udp_token);
+        }
+        if (!unix_socket.empty()) {
+            broker.enable_unix_socket(unix_socket);
+        }
+        if (!shm_socket.empty()) {
+            broker.enable_shm(shm_socket);
+        }
+        if (io_uring) {
+            broker.enable_io_uring();
+        }
+        
         std::signal(SIGINT, signal_handler);
         std::signal(SIGTERM, signal_handler);
         
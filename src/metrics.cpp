@@ -0,0 +1,53 @@
+#include "metrics.h"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tinymq {
+namespace metrics {
+
+namespace {
+
+struct Registry {
+    std::mutex mutex;
+    // Blocks are never freed so that totals survive thread exit
+    std::vector<std::unique_ptr<ThreadCounters>> threads;
+};
+
+Registry& registry() {
+    static Registry* instance = new Registry();
+    return *instance;
+}
+
+} // namespace
+
+ThreadCounters* register_thread() {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.threads.push_back(std::make_unique<ThreadCounters>());
+    return reg.threads.back().get();
+}
+
+std::unique_ptr<Snapshot> collect() {
+    auto snapshot = std::make_unique<Snapshot>();
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    
+    for (const auto& thread : reg.threads) {
+        for (size_t i = 0; i < counter_count; ++i) {
+            snapshot->counters[i] += thread->counters[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < packet_type_slots; ++i) {
+            snapshot->packets_in[i] += thread->packets_in[i].load(std::memory_order_relaxed);
+            snapshot->packets_out[i] += thread->packets_out[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < stage_count; ++i) {
+            snapshot->latencies[i].merge(thread->latencies[i]);
+        }
+    }
+    
+    return snapshot;
+}
+
+} // namespace metrics
+} // namespace tinymq
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "histogram.h"
+#include "packet.h"
+
+namespace tinymq {
+namespace metrics {
+
+enum class Counter : size_t {
+    MessagesIn,      // PUB packets accepted from clients
+    MessagesOut,     // PUB frames written to subscribers
+    BytesIn,         // Bytes read from client sockets
+    BytesOut,        // Bytes written to client sockets
+    FramesQueued,    // Frames added to a session's outbound queue
+    FramesWritten,   // Frames whose write completed
+    FramesAbandoned, // Queued frames discarded when their session failed
+    Drops,           // Frames discarded (queue overflow or failed session)
+    DatagramsIn,     // Datagrams received by the UDP listener
+    DatagramsDropped,// Datagrams discarded as malformed, oversized or unauthorized
+    Count
+};
+
+// Stages of the publish pipeline, timed in nanoseconds
+enum class Stage : size_t {
+    ReadToRoute,           // PUB payload read -> subscribers resolved
+    RouteToEnqueue,        // Subscribers resolved -> frame queued on a subscriber
+    EnqueueToWrite,        // Frame queued -> subscriber write completed
+    Count
+};
+
+constexpr size_t stage_count = static_cast<size_t>(Stage::Count);
+
+using clock = std::chrono::steady_clock;
+
+constexpr size_t counter_count = static_cast<size_t>(Counter::Count);
+constexpr size_t packet_type_slots = 16;  // Packet types at or above this share the last slot
+
+// Counters owned by one thread. Only the owning thread writes them, so an
+// increment is a relaxed load and store (a plain add on common targets);
+// the atomics only make the concurrent read from the scraper well-defined.
+struct alignas(64) ThreadCounters {
+    std::array<std::atomic<uint64_t>, counter_count> counters;
+    std::array<std::atomic<uint64_t>, packet_type_slots> packets_in;
+    std::array<std::atomic<uint64_t>, packet_type_slots> packets_out;
+    std::array<Histogram, stage_count> latencies;
+};
+
+ThreadCounters* register_thread();
+
+inline thread_local ThreadCounters* tls_counters = nullptr;
+
+inline ThreadCounters& local() {
+    if (!tls_counters) {
+        tls_counters = register_thread();
+    }
+    return *tls_counters;
+}
+
+inline void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline size_t packet_slot(PacketType type) {
+    size_t slot = static_cast<size_t>(type);
+    return slot < packet_type_slots ? slot : packet_type_slots - 1;
+}
+
+inline void add(Counter counter, uint64_t n = 1) {
+    bump(local().counters[static_cast<size_t>(counter)], n);
+}
+
+inline void packet_in(PacketType type) {
+    bump(local().packets_in[packet_slot(type)], 1);
+}
+
+inline void packet_out(PacketType type) {
+    bump(local().packets_out[packet_slot(type)], 1);
+}
+
+inline void record_latency(Stage stage, clock::time_point start, clock::time_point end = clock::now()) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    local().latencies[static_cast<size_t>(stage)].record(elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0);
+}
+
+struct Snapshot {
+    std::array<uint64_t, counter_count> counters{};
+    std::array<uint64_t, packet_type_slots> packets_in{};
+    std::array<uint64_t, packet_type_slots> packets_out{};
+    std::array<HistogramSnapshot, stage_count> latencies{};
+
+    uint64_t get(Counter counter) const { return counters[static_cast<size_t>(counter)]; }
+    const HistogramSnapshot& latency(Stage stage) const { return latencies[static_cast<size_t>(stage)]; }
+};
+
+// Sums the counters and merges the histograms of every thread that has ever
+// recorded a value. The snapshot is large; keep it off small stacks.
+std::unique_ptr<Snapshot> collect();
+
+} // namespace metrics
+} // namespace tinymq
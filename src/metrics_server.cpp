@@ -0,0 +1,202 @@
+#include "metrics_server.h"
+#include "broker.h"
+#include "metrics.h"
+#include "terminal_ui.h"
+#include <memory>
+#include <sstream>
+
+namespace tinymq {
+
+namespace {
+
+class HttpConnection : public std::enable_shared_from_this<HttpConnection> {
+public:
+    HttpConnection(boost::asio::ip::tcp::socket socket, const MetricsServer& server)
+        : socket_(std::move(socket)), server_(server) {
+    }
+    
+    void start() {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(
+            socket_, request_, "\r\n\r\n",
+            [this, self](boost::system::error_code ec, std::size_t /*length*/) {
+                if (ec) {
+                    return;
+                }
+                
+                std::istream is(&request_);
+                std::string method, target;
+                is >> method >> target;
+                
+                if (method == "GET" && (target == "/metrics" || target == "/")) {
+                    respond("200 OK", server_.render());
+                } else {
+                    respond("404 Not Found", "not found\n");
+                }
+            });
+    }
+
+private:
+    void respond(const std::string& status, const std::string& body) {
+        response_ = "HTTP/1.1 " + status + "\r\n"
+                    "Content-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                    "Connection: close\r\n\r\n" + body;
+        
+        auto self = shared_from_this();
+        boost::asio::async_write(
+            socket_, boost::asio::buffer(response_),
+            [this, self](boost::system::error_code /*ec*/, std::size_t /*length*/) {
+                boost::system::error_code ignored;
+                socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+            });
+    }
+
+    boost::asio::ip::tcp::socket socket_;
+    const MetricsServer& server_;
+    boost::asio::streambuf request_;
+    std::string response_;
+};
+
+const char* packet_type_name(size_t slot) {
+    switch (static_cast<PacketType>(slot)) {
+        case PacketType::CONN:     return "CONN";
+        case PacketType::CONNACK:  return "CONNACK";
+        case PacketType::PUB:      return "PUB";
+        case PacketType::PUBACK:   return "PUBACK";
+        case PacketType::SUB:      return "SUB";
+        case PacketType::SUBACK:   return "SUBACK";
+        case PacketType::UNSUB:    return "UNSUB";
+        case PacketType::UNSUBACK: return "UNSUBACK";
+    }
+    return nullptr;
+}
+
+void write_metric(std::ostringstream& out, const std::string& name, const std::string& type,
+                  const std::string& help, uint64_t value) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+    out << name << " " << value << "\n";
+}
+
+void write_packet_metric(std::ostringstream& out, const std::string& name, const std::string& help,
+                         const std::array<uint64_t, metrics::packet_type_slots>& values) {
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " counter\n";
+    uint64_t other = 0;
+    for (size_t slot = 0; slot < values.size(); ++slot) {
+        if (const char* type_name = packet_type_name(slot)) {
+            out << name << "{type=\"" << type_name << "\"} " << values[slot] << "\n";
+        } else {
+            other += values[slot];
+        }
+    }
+    out << name << "{type=\"other\"} " << other << "\n";
+}
+
+void write_latency_metric(std::ostringstream& out, const std::string& name, const std::string& help,
+                          const metrics::HistogramSnapshot& histogram) {
+    static const std::pair<const char*, double> quantiles[] = {
+        {"0.5", 0.5}, {"0.99", 0.99}, {"0.999", 0.999}
+    };
+    
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " summary\n";
+    for (const auto& quantile : quantiles) {
+        out << name << "{quantile=\"" << quantile.first << "\"} "
+            << static_cast<double>(histogram.percentile(quantile.second)) / 1e9 << "\n";
+    }
+    out << name << "_sum " << static_cast<double>(histogram.sum) / 1e9 << "\n";
+    out << name << "_count " << histogram.count << "\n";
+}
+
+} // namespace
+
+MetricsServer::MetricsServer(boost::asio::io_context& io_context, uint16_t port, Broker& broker)
+    : acceptor_(io_context, boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4::loopback(), port)),
+      broker_(broker) {
+}
+
+void MetricsServer::start() {
+    accept_connections();
+}
+
+void MetricsServer::stop() {
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+}
+
+uint16_t MetricsServer::port() const {
+    return acceptor_.local_endpoint().port();
+}
+
+void MetricsServer::accept_connections() {
+    acceptor_.async_accept(
+        [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+            if (ec == boost::asio::error::operation_aborted) {
+                return;
+            }
+            
+            if (!ec) {
+                std::make_shared<HttpConnection>(std::move(socket), *this)->start();
+            } else {
+                ui::print_message("Metrics", "Accept error: " + ec.message(), ui::MessageType::ERROR);
+            }
+            
+            if (acceptor_.is_open()) {
+                accept_connections();
+            }
+        });
+}
+
+std::string MetricsServer::render() const {
+    using metrics::Counter;
+    
+    auto snapshot_ptr = metrics::collect();
+    const auto& snapshot = *snapshot_ptr;
+    auto& admission = broker_.admission();
+    std::ostringstream out;
+    
+    write_metric(out, "tinymq_messages_in_total", "counter", "PUB messages received from clients",
+                 snapshot.get(Counter::MessagesIn));
+    write_metric(out, "tinymq_messages_out_total", "counter", "PUB messages delivered to subscribers",
+                 snapshot.get(Counter::MessagesOut));
+    write_metric(out, "tinymq_bytes_in_total", "counter", "Bytes read from client connections",
+                 snapshot.get(Counter::BytesIn));
+    write_metric(out, "tinymq_bytes_out_total", "counter", "Bytes written to client connections",
+                 snapshot.get(Counter::BytesOut));
+    write_packet_metric(out, "tinymq_packets_in_total", "Packets received by type", snapshot.packets_in);
+    write_packet_metric(out, "tinymq_packets_out_total", "Packets queued for sending by type",
+                        snapshot.packets_out);
+    write_metric(out, "tinymq_drops_total", "counter", "Outbound frames discarded",
+                 snapshot.get(Counter::Drops));
+    write_metric(out, "tinymq_datagrams_in_total", "counter", "PUB datagrams received over UDP",
+                 snapshot.get(Counter::DatagramsIn));
+    write_metric(out, "tinymq_datagrams_dropped_total", "counter", "UDP datagrams discarded as invalid",
+                 snapshot.get(Counter::DatagramsDropped));
+    
+    uint64_t finished = snapshot.get(Counter::FramesWritten) + snapshot.get(Counter::FramesAbandoned);
+    uint64_t queued = snapshot.get(Counter::FramesQueued);
+    write_metric(out, "tinymq_outbound_queue_depth", "gauge", "Frames waiting to be written across all sessions",
+                 queued > finished ? queued - finished : 0);
+    
+    write_metric(out, "tinymq_active_sessions", "gauge", "Open client sessions",
+                 admission.active_sessions());
+    write_metric(out, "tinymq_pending_handshakes", "gauge", "Sessions that have not sent CONN yet",
+                 admission.pending_handshakes());
+    write_metric(out, "tinymq_connections_refused_total", "counter", "Connections refused by admission control",
+                 admission.refused());
+    write_metric(out, "tinymq_topics", "gauge", "Topics with at least one subscriber",
+                 broker_.topic_count());
+    
+    write_latency_metric(out, "tinymq_read_to_route_seconds", "Time from PUB read to subscriber lookup",
+                         snapshot.latency(metrics::Stage::ReadToRoute));
+    write_latency_metric(out, "tinymq_route_to_enqueue_seconds", "Time from subscriber lookup to frame queued",
+                         snapshot.latency(metrics::Stage::RouteToEnqueue));
+    write_latency_metric(out, "tinymq_enqueue_to_write_seconds", "Time from frame queued to write completion",
+                         snapshot.latency(metrics::Stage::EnqueueToWrite));
+    
+    return out.str();
+}
+
+} // namespace tinymq
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+
+namespace tinymq {
+
+class Broker;
+
+// Minimal HTTP endpoint serving GET /metrics in the Prometheus text format.
+// Runs on the broker's io_context and binds to the loopback interface only.
+class MetricsServer {
+public:
+    MetricsServer(boost::asio::io_context& io_context, uint16_t port, Broker& broker);
+    
+    void start();
+    void stop();
+    
+    uint16_t port() const;
+    
+    std::string render() const;
+
+private:
+    void accept_connections();
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+    Broker& broker_;
+};
+
+} // namespace tinymq
@@ -54,4 +54,120 @@ bool Packet::deserialize(const std::vector<uint8_t>& data) {
     return true;
 }
 
+bool parse_publish(const std::vector<uint8_t>& payload, std::string& topic, std::vector<uint8_t>& message) {
+    if (payload.size() <= 1) {
+        return false;
+    }
+    
+    uint8_t topic_length = payload[0];
+    if (payload.size() <= static_cast<size_t>(topic_length) + 1) {
+        return false;
+    }
+    
+    topic.assign(payload.begin() + 1, payload.begin() + 1 + topic_length);
+    message.assign(payload.begin() + 1 + topic_length, payload.end());
+    return true;
+}
+
+std::vector<std::vector<uint8_t>> encode_topic_batches(const std::vector<std::string>& topics) {
+    std::vector<std::vector<uint8_t>> batches;
+    std::vector<uint8_t> current;
+    
+    for (const auto& topic : topics) {
+        if (topic.empty() || topic.size() > 255) {
+            continue;
+        }
+        if (current.size() + 1 + topic.size() > 0xFFFF) {
+            batches.push_back(std::move(current));
+            current.clear();
+        }
+        current.push_back(static_cast<uint8_t>(topic.size()));
+        current.insert(current.end(), topic.begin(), topic.end());
+    }
+    
+    if (!current.empty()) {
+        batches.push_back(std::move(current));
+    }
+    
+    return batches;
+}
+
+bool parse_topic_batch(const std::vector<uint8_t>& payload, std::vector<std::string>& topics) {
+    size_t offset = 0;
+    while (offset < payload.size()) {
+        size_t topic_length = payload[offset];
+        if (topic_length == 0 || offset + 1 + topic_length > payload.size()) {
+            return false;
+        }
+        topics.emplace_back(payload.begin() + offset + 1, payload.begin() + offset + 1 + topic_length);
+        offset += 1 + topic_length;
+    }
+    return true;
+}
+
+
+std::vector<uint8_t> encode_publish_datagram(const std::string& topic, const std::vector<uint8_t>& message,
+                                             const std::string& token) {
+    size_t token_size = token.empty() ? 0 : 1 + token.size();
+    size_t payload_size = token_size + 1 + topic.size() + message.size();
+    if (topic.size() > 255 || token.size() > 255 || payload_size > 0xFFFF) {
+        return {};
+    }
+    
+    std::vector<uint8_t> datagram;
+    datagram.reserve(4 + payload_size);
+    datagram.push_back(static_cast<uint8_t>(PacketType::PUB));
+    datagram.push_back(token.empty() ? 0 : FLAG_TOKEN);
+    datagram.push_back(static_cast<uint8_t>(payload_size >> 8));
+    datagram.push_back(static_cast<uint8_t>(payload_size & 0xFF));
+    if (!token.empty()) {
+        datagram.push_back(static_cast<uint8_t>(token.size()));
+        datagram.insert(datagram.end(), token.begin(), token.end());
+    }
+    datagram.push_back(static_cast<uint8_t>(topic.size()));
+    datagram.insert(datagram.end(), topic.begin(), topic.end());
+    datagram.insert(datagram.end(), message.begin(), message.end());
+    return datagram;
+}
+
+bool parse_publish_datagram(const uint8_t* data, size_t length, std::string_view& token,
+                            std::string_view& topic, std::string_view& message) {
+    if (length < 4 || static_cast<PacketType>(data[0]) != PacketType::PUB) {
+        return false;
+    }
+    
+    size_t payload_length = (static_cast<size_t>(data[2]) << 8) | data[3];
+    if (length != 4 + payload_length) {
+        return false;
+    }
+    
+    const char* p = reinterpret_cast<const char*>(data) + 4;
+    const char* end = p + payload_length;
+    
+    token = std::string_view();
+    if (data[1] & FLAG_TOKEN) {
+        if (p == end) {
+            return false;
+        }
+        size_t token_length = static_cast<uint8_t>(*p);
+        if (static_cast<size_t>(end - p) <= token_length) {
+            return false;
+        }
+        token = std::string_view(p + 1, token_length);
+        p += 1 + token_length;
+    }
+    
+    // Same rule as parse_publish: a topic and a non-empty message
+    if (p == end) {
+        return false;
+    }
+    size_t topic_length = static_cast<uint8_t>(*p);
+    if (static_cast<size_t>(end - p) <= topic_length + 1) {
+        return false;
+    }
+    topic = std::string_view(p + 1, topic_length);
+    message = std::string_view(p + 1 + topic_length, static_cast<size_t>(end - p) - 1 - topic_length);
+    return true;
+}
+
 } // namespace tinymq 
\ No newline at end of file
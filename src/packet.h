@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace tinymq {
@@ -17,6 +19,10 @@ enum class PacketType : uint8_t {
     UNSUBACK = 0x08   // Unsubscribe acknowledgement
 };
 
+// Header flags
+constexpr uint8_t FLAG_BATCH = 0x01;  // SUB payload is a list of length-prefixed topics
+constexpr uint8_t FLAG_TOKEN = 0x02;  // Datagram PUB payload starts with [length][client token]
+
 struct PacketHeader {
     PacketType type;
     uint8_t flags;
@@ -42,4 +48,27 @@ private:
     std::vector<uint8_t> payload_;
 };
 
+// Splits a PUB payload (topic length, topic, message) into its parts.
+// Returns false if the payload is too short to hold a topic and message.
+bool parse_publish(const std::vector<uint8_t>& payload, std::string& topic, std::vector<uint8_t>& message);
+
+// Encodes topics as [length][topic]... payloads for a FLAG_BATCH SUB, split
+// so that no payload exceeds the 16-bit length limit. Topics longer than
+// 255 bytes are skipped.
+std::vector<std::vector<uint8_t>> encode_topic_batches(const std::vector<std::string>& topics);
+
+// Decodes a FLAG_BATCH payload. Returns false if it is truncated.
+bool parse_topic_batch(const std::vector<uint8_t>& payload, std::vector<std::string>& topics);
+
+// A PUB datagram is a complete PUB packet sent over UDP, optionally carrying
+// a client token (FLAG_TOKEN). Returns an empty vector if the topic or token
+// is longer than 255 bytes or the packet would not fit the length field.
+std::vector<uint8_t> encode_publish_datagram(const std::string& topic, const std::vector<uint8_t>& message,
+                                             const std::string& token = "");
+
+// Splits a PUB datagram; token is empty if it carries none. The views point
+// into data. Returns false if the datagram is not a well-formed PUB.
+bool parse_publish_datagram(const uint8_t* data, size_t length, std::string_view& token,
+                            std::string_view& topic, std::string_view& message);
+
 } // namespace tinymq 
\ No newline at end of file
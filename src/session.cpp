@@ -1,75 +1,159 @@
 #include "session.h"
 #include "broker.h"
+#include "metrics.h"
 #include "terminal_ui.h"
 #include <iostream>
 
 namespace tinymq {
 
+namespace {
+
+std::string describe_peer(const boost::asio::ip::tcp::socket& socket) {
+    boost::system::error_code ec;
+    auto endpoint = socket.remote_endpoint(ec);
+    return ec ? "unknown" : endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+}
+
+std::string describe_peer(const boost::asio::local::stream_protocol::socket& socket) {
+    boost::system::error_code ec;
+    auto endpoint = socket.local_endpoint(ec);
+    return ec ? "unix" : "unix:" + endpoint.path();
+}
+
+std::string describe_peer(const UringStream& stream) {
+    boost::system::error_code ec;
+    auto endpoint = stream.remote_endpoint(ec);
+    return ec ? "unknown" : endpoint.address().to_string() + ":" + std::to_string(endpoint.port());
+}
+
+} // namespace
+
 Session::Session(boost::asio::ip::tcp::socket socket, Broker& broker)
-    : socket_(std::move(socket)),
+    : remote_endpoint_(describe_peer(socket)),
+      socket_(std::move(socket)),
+      broker_(broker),
+      handshake_timer_(socket_.get_executor()) {
+}
+
+Session::Session(boost::asio::local::stream_protocol::socket socket, Broker& broker)
+    : remote_endpoint_(describe_peer(socket)),
+      socket_(std::move(socket)),
       broker_(broker),
-      read_buffer_(1024) {
+      handshake_timer_(socket_.get_executor()) {
+}
+
+Session::Session(std::shared_ptr<ShmChannel> channel, Broker& broker)
+    : remote_endpoint_(channel->peer()),
+      socket_(channel->get_executor()),
+      shm_(std::move(channel)),
+      broker_(broker),
+      handshake_timer_(socket_.get_executor()) {
+}
+
+Session::Session(std::shared_ptr<UringStream> stream, Broker& broker)
+    : remote_endpoint_(describe_peer(*stream)),
+      socket_(stream->get_executor()),
+      uring_(std::move(stream)),
+      broker_(broker),
+      handshake_timer_(socket_.get_executor()) {
+}
+
+Session::~Session() {
+    if (uring_) {
+        // Ends the multishot receive, which keeps the stream alive otherwise
+        uring_->close();
+    }
+    broker_.admission().session_closed(handshake_pending_.load());
 }
 
 void Session::start() {
+    start_handshake_timer();
     read_header();
 }
 
-std::string Session::remote_endpoint() const {
-    try {
-        return socket_.remote_endpoint().address().to_string() + ":" + 
-               std::to_string(socket_.remote_endpoint().port());
-    } catch (const std::exception&) {
-        return "unknown";
+void Session::start_handshake_timer() {
+    auto timeout = broker_.admission().limits().handshake_timeout;
+    if (timeout.count() <= 0) {
+        return;
+    }
+    
+    auto self = shared_from_this();
+    handshake_timer_.expires_after(timeout);
+    handshake_timer_.async_wait([this, self](boost::system::error_code ec) {
+        if (!ec && handshake_pending_.load()) {
+            ui::print_message("Session", "Handshake timeout for " + remote_endpoint(), 
+                            ui::MessageType::WARNING);
+            close_stream();
+        }
+    });
+}
+
+void Session::close_stream() {
+    if (shm_) {
+        shm_->close();
+    } else if (uring_) {
+        uring_->close();
+    } else {
+        boost::system::error_code ec;
+        socket_.close(ec);
     }
 }
 
 void Session::read_header() {
     auto self = shared_from_this();
-    boost::asio::async_read(
-        socket_,
-        boost::asio::buffer(read_buffer_.data(), header_length),
-        [this, self](boost::system::error_code ec, std::size_t length) {
-            if (!ec && length == header_length) {
-                PacketHeader header;
-                header.type = static_cast<PacketType>(read_buffer_[0]);
-                header.flags = read_buffer_[1];
-                header.payload_length = (static_cast<uint16_t>(read_buffer_[2]) << 8) | read_buffer_[3];
-                
-                if (header.payload_length > 0) {
-                    read_payload(header);
+    with_stream([&](auto& stream) {
+        boost::asio::async_read(
+            stream,
+            boost::asio::buffer(header_buffer_),
+            [this, self](boost::system::error_code ec, std::size_t length) {
+                if (!ec && length == header_length) {
+                    PacketHeader header;
+                    header.type = static_cast<PacketType>(header_buffer_[0]);
+                    header.flags = header_buffer_[1];
+                    header.payload_length = (static_cast<uint16_t>(header_buffer_[2]) << 8) | header_buffer_[3];
+                    
+                    metrics::add(metrics::Counter::BytesIn, length);
+                    metrics::packet_in(header.type);
+                    
+                    if (header.payload_length > 0) {
+                        read_payload(header);
+                    } else {
+                        Packet packet(header.type, header.flags, {});
+                        process_packet(packet);
+                    }
                 } else {
-                    Packet packet(header.type, header.flags, {});
-                    process_packet(packet);
+                    ui::print_message("Session", "Read header error: " + ec.message(), ui::MessageType::ERROR);
+                    broker_.remove_session(shared_from_this());
                 }
-            } else {
-                ui::print_message("Session", "Read header error: " + ec.message(), ui::MessageType::ERROR);
-                broker_.remove_session(shared_from_this());
-            }
-        });
+            });
+    });
 }
 
 void Session::read_payload(PacketHeader header) {
     auto self = shared_from_this();
     
-    if (read_buffer_.size() < header.payload_length) {
-        read_buffer_.resize(header.payload_length);
-    }
+    payload_buffer_ = BufferPool::acquire(header.payload_length);
     
-    boost::asio::async_read(
-        socket_,
-        boost::asio::buffer(read_buffer_.data(), header.payload_length),
-        [this, self, header](boost::system::error_code ec, std::size_t length) {
-            if (!ec && length == header.payload_length) {
-                std::vector<uint8_t> payload(read_buffer_.begin(), read_buffer_.begin() + length);
-                Packet packet(header.type, header.flags, payload);
-                
-                process_packet(packet);
-            } else {
-                ui::print_message("Session", "Read payload error: " + ec.message(), ui::MessageType::ERROR);
-                broker_.remove_session(shared_from_this());
-            }
-        });
+    with_stream([&](auto& stream) {
+        boost::asio::async_read(
+            stream,
+            boost::asio::buffer(payload_buffer_.data(), header.payload_length),
+            [this, self, header](boost::system::error_code ec, std::size_t length) {
+                if (!ec && length == header.payload_length) {
+                    last_read_at_ = metrics::clock::now();
+                    metrics::add(metrics::Counter::BytesIn, length);
+                    
+                    std::vector<uint8_t> payload(payload_buffer_.data(), payload_buffer_.data() + length);
+                    payload_buffer_.reset();
+                    Packet packet(header.type, header.flags, payload);
+                    
+                    process_packet(packet);
+                } else {
+                    ui::print_message("Session", "Read payload error: " + ec.message(), ui::MessageType::ERROR);
+                    broker_.remove_session(shared_from_this());
+                }
+            });
+    });
 }
 
 void Session::process_packet(const Packet& packet) {
@@ -105,6 +189,11 @@ void Session::handle_connect(const Packet& packet) {
         client_id_ = std::string(payload.begin(), payload.end());
         is_authenticated_ = true;
         
+        if (handshake_pending_.exchange(false)) {
+            handshake_timer_.cancel();
+            broker_.admission().handshake_completed();
+        }
+        
         ui::print_message("Session", "Client connected: " + client_id_ + 
                          " from " + remote_endpoint(), ui::MessageType::SUCCESS);
         
@@ -113,7 +202,7 @@ void Session::handle_connect(const Packet& packet) {
         broker_.register_session(shared_from_this());
     } else {
         ui::print_message("Session", "Invalid CONNECT packet (empty client ID)", ui::MessageType::ERROR);
-        socket_.close();
+        close_stream();
     }
 }
 
@@ -123,36 +212,33 @@ void Session::handle_publish(const Packet& packet) {
         return;
     }
     
-    const auto& payload = packet.payload();
+    std::string topic;
+    std::vector<uint8_t> message_payload;
+    if (!parse_publish(packet.payload(), topic, message_payload)) {
+        return;
+    }
     
-    if (payload.size() > 1) {
-        uint8_t topic_length = payload[0];
-        
-        if (payload.size() > topic_length + 1) {
-            std::string topic(payload.begin() + 1, payload.begin() + 1 + topic_length);
-            std::vector<uint8_t> message_payload(payload.begin() + 1 + topic_length, payload.end());
-            
-            std::string msg_preview;
-            for (size_t i = 0; i < std::min(message_payload.size(), size_t(20)); ++i) {
-                char c = static_cast<char>(message_payload[i]);
-                if (isprint(c)) {
-                    msg_preview += c;
-                } else {
-                    msg_preview += '?';
-                }
-            }
-            if (message_payload.size() > 20) {
-                msg_preview += "...";
-            }
-            
-            ui::print_message("Session", "Client " + client_id_ + " published to topic '" + 
-                             topic + "': " + msg_preview, ui::MessageType::OUTGOING);
-            
-            broker_.publish(topic, message_payload);
-            
-            send_ack(PacketType::PUBACK);
+    std::string msg_preview;
+    for (size_t i = 0; i < std::min(message_payload.size(), size_t(20)); ++i) {
+        char c = static_cast<char>(message_payload[i]);
+        if (isprint(c)) {
+            msg_preview += c;
+        } else {
+            msg_preview += '?';
         }
     }
+    if (message_payload.size() > 20) {
+        msg_preview += "...";
+    }
+    
+    ui::print_message("Session", "Client " + client_id_ + " published to topic '" + 
+                     topic + "': " + msg_preview, ui::MessageType::OUTGOING);
+    
+    metrics::add(metrics::Counter::MessagesIn);
+    
+    broker_.publish(topic, message_payload, last_read_at_);
+    
+    send_ack(PacketType::PUBACK);
 }
 
 void Session::handle_subscribe(const Packet& packet) {
@@ -163,7 +249,24 @@ void Session::handle_subscribe(const Packet& packet) {
     
     const auto& payload = packet.payload();
     
-    if (!payload.empty()) {
+    if (packet.flags() & FLAG_BATCH) {
+        std::vector<std::string> topics;
+        if (!parse_topic_batch(payload, topics)) {
+            ui::print_message("Session", "Malformed batched SUB from client " + client_id_, 
+                            ui::MessageType::WARNING);
+            return;
+        }
+        
+        ui::print_message("Session", "Client " + client_id_ + " subscribing to " + 
+                        std::to_string(topics.size()) + " topics", ui::MessageType::INFO);
+        
+        auto self = shared_from_this();
+        for (const auto& topic : topics) {
+            broker_.subscribe(self, topic);
+        }
+        
+        send_ack(PacketType::SUBACK);
+    } else if (!payload.empty()) {
         std::string topic(payload.begin(), payload.end());
         
         ui::print_message("Session", "Client " + client_id_ + " subscribing to topic: " + topic, 
@@ -207,18 +310,104 @@ void Session::send_ack(PacketType ack_type, uint16_t packet_id) {
 }
 
 void Session::send_packet(const Packet& packet) {
-    auto serialized = packet.serialize();
-    auto self = shared_from_this();
-    
-    boost::asio::async_write(
-        socket_,
-        boost::asio::buffer(serialized),
-        [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-            if (ec) {
-                ui::print_message("Session", "Write error: " + ec.message(), ui::MessageType::ERROR);
-                broker_.remove_session(shared_from_this());
+    send_frame(std::make_shared<const std::vector<uint8_t>>(packet.serialize()));
+}
+
+void Session::send_frame(std::shared_ptr<const std::vector<uint8_t>> frame) {
+    auto type = static_cast<PacketType>((*frame)[0]);
+    bool overflowed = false;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        size_t queued = write_queue_.size() - write_head_;
+        // Only fan-out PUBs may be dropped: the client pairs acks with its
+        // requests in order, so a lost ack would misalign every later one
+        if (type == PacketType::PUB && queued >= max_write_queue) {
+            metrics::add(metrics::Counter::Drops);
+            return;
+        }
+        overflowed = queued >= max_write_backlog;
+        if (!overflowed) {
+            metrics::add(metrics::Counter::FramesQueued);
+            metrics::packet_out(type);
+            
+            write_queue_.push_back({std::move(frame), metrics::clock::now()});
+            if (writing_) {
+                return;
             }
-        });
+            writing_ = true;
+        }
+    }
+    
+    if (overflowed) {
+        // The client is not reading its acks; cut it off rather than grow without bound
+        metrics::add(metrics::Counter::Drops);
+        ui::print_message("Session", "Write backlog full, closing " + remote_endpoint(),
+                          ui::MessageType::WARNING);
+        close_stream();
+        return;
+    }
+    
+    write_next();
+}
+
+void Session::write_next() {
+    QueuedFrame queued;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        queued = write_queue_[write_head_];
+    }
+    
+    auto self = shared_from_this();
+    with_stream([&](auto& stream) {
+        boost::asio::async_write(
+            stream,
+            boost::asio::buffer(*queued.frame),
+            [this, self, queued](boost::system::error_code ec, std::size_t length) {
+                if (ec) {
+                    ui::print_message("Session", "Write error: " + ec.message(), ui::MessageType::ERROR);
+                    {
+                        std::lock_guard<std::mutex> lock(write_mutex_);
+                        size_t abandoned = write_queue_.size() - write_head_;
+                        metrics::add(metrics::Counter::FramesAbandoned, abandoned);
+                        metrics::add(metrics::Counter::Drops, abandoned);
+                        std::vector<QueuedFrame>().swap(write_queue_);
+                        write_head_ = 0;
+                        writing_ = false;
+                    }
+                    broker_.remove_session(shared_from_this());
+                    return;
+                }
+                
+                metrics::add(metrics::Counter::FramesWritten);
+                metrics::add(metrics::Counter::BytesOut, length);
+                if (static_cast<PacketType>((*queued.frame)[0]) == PacketType::PUB) {
+                    metrics::add(metrics::Counter::MessagesOut);
+                    metrics::record_latency(metrics::Stage::EnqueueToWrite, queued.enqueued_at);
+                }
+                
+                {
+                    std::lock_guard<std::mutex> lock(write_mutex_);
+                    write_queue_[write_head_++].frame.reset();
+                    if (write_head_ == write_queue_.size()) {
+                        // Drained: drop the backlog's memory if a burst grew it
+                        if (write_queue_.capacity() > idle_write_queue_capacity) {
+                            std::vector<QueuedFrame>().swap(write_queue_);
+                        } else {
+                            write_queue_.clear();
+                        }
+                        write_head_ = 0;
+                        writing_ = false;
+                        return;
+                    }
+                    if (write_head_ >= idle_write_queue_capacity && write_head_ * 2 >= write_queue_.size()) {
+                        write_queue_.erase(write_queue_.begin(), write_queue_.begin() + write_head_);
+                        write_head_ = 0;
+                    }
+                }
+                
+                write_next();
+            });
+    });
 }
 
 } // namespace tinymq 
\ No newline at end of file
@@ -1,28 +1,47 @@
 #pragma once
 
 #include <boost/asio.hpp>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
+#include "buffer_pool.h"
+#include "metrics.h"
 #include "packet.h"
+#include "shm_channel.h"
+#include "uring_stream.h"
 
 namespace tinymq {
 
 class Broker;
 
+// One client connection over TCP, a Unix domain socket, a shared memory
+// channel or TCP driven through io_uring. Sockets are held as a generic
+// stream socket; reads and writes go through with_stream, so the rest of the
+// broker sees one Session type.
 class Session : public std::enable_shared_from_this<Session> {
 public:
     Session(boost::asio::ip::tcp::socket socket, Broker& broker);
+    Session(boost::asio::local::stream_protocol::socket socket, Broker& broker);
+    Session(std::shared_ptr<ShmChannel> channel, Broker& broker);
+    Session(std::shared_ptr<UringStream> stream, Broker& broker);
+    
+    ~Session();
     
     void start();
     
     void send_packet(const Packet& packet);
     
+    // Queues an already serialized frame; the buffer may be shared between sessions
+    void send_frame(std::shared_ptr<const std::vector<uint8_t>> frame);
+    
     const std::string& client_id() const { return client_id_; }
     
     bool is_authenticated() const { return is_authenticated_; }
     
-    std::string remote_endpoint() const;
+    const std::string& remote_endpoint() const { return remote_endpoint_; }
 
 private:
     void read_header();
@@ -37,14 +56,51 @@ private:
     void handle_unsubscribe(const Packet& packet);
     
     void send_ack(PacketType ack_type, uint16_t packet_id = 0);
+    
+    void start_handshake_timer();
+    
+    void write_next();
+    
+    template <typename Operation>
+    void with_stream(Operation&& operation) {
+        if (shm_) {
+            operation(*shm_);
+        } else if (uring_) {
+            operation(*uring_);
+        } else {
+            operation(socket_);
+        }
+    }
+    void close_stream();
 
 private:
-    boost::asio::ip::tcp::socket socket_;
+    std::string remote_endpoint_;   // Described before socket_ takes over the connection
+    boost::asio::generic::stream_protocol::socket socket_;
+    std::shared_ptr<ShmChannel> shm_;   // Set instead of socket_ for shared memory sessions
+    std::shared_ptr<UringStream> uring_;   // Set instead of socket_ for io_uring sessions
     Broker& broker_;
     std::string client_id_;
     bool is_authenticated_{false};
-    std::vector<uint8_t> read_buffer_;
+    std::atomic<bool> handshake_pending_{true};
+    boost::asio::steady_timer handshake_timer_;
+    // Payload buffers come from the pool only while a payload is being read,
+    // so an idle session holds no read memory beyond the header bytes
+    std::array<uint8_t, 4> header_buffer_{};
+    PooledBuffer payload_buffer_;
+    metrics::clock::time_point last_read_at_;
+    
+    struct QueuedFrame {
+        std::shared_ptr<const std::vector<uint8_t>> frame;
+        metrics::clock::time_point enqueued_at;
+    };
+    std::mutex write_mutex_;
+    std::vector<QueuedFrame> write_queue_;  // Pending frames start at write_head_
+    size_t write_head_{0};
+    bool writing_{false};
     static constexpr size_t header_length = 4;
+    static constexpr size_t max_write_queue = 4096;     // Beyond this, fan-out PUBs are dropped
+    static constexpr size_t max_write_backlog = 16384;  // Beyond this, the session is closed
+    static constexpr size_t idle_write_queue_capacity = 8;
 };
 
 } // namespace tinymq 
\ No newline at end of file
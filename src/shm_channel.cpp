@@ -0,0 +1,458 @@
+#include "shm_channel.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tinymq {
+
+// Shared header at the start of the segment; the two rings' data follows it.
+// rings[s] carries bytes written by side s: side s only advances its head,
+// the other side only advances its tail. Every index and flag access is
+// sequentially consistent so that "set sleeping, then re-check the ring" on
+// one side and "move the index, then check sleeping" on the other cannot both
+// miss each other.
+struct ShmChannel::Segment {
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head;
+        alignas(64) std::atomic<uint64_t> tail;
+    };
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    alignas(64) std::atomic<uint32_t> sleeping[2];
+    std::atomic<uint32_t> closed[2];
+    Ring rings[2];
+};
+
+namespace {
+
+constexpr uint32_t segment_magic = 0x544d5153;   // "TMQS"
+constexpr uint32_t segment_version = 1;
+constexpr size_t header_size = (sizeof(ShmChannel::Segment) + 63) & ~size_t(63);
+constexpr size_t min_ring_capacity = 4096;
+constexpr size_t max_ring_capacity = size_t(1) << 30;
+constexpr char handoff_tag[4] = {'T', 'M', 'Q', 'S'};
+// The broker maps a segment whose size the client controls; sealing it stops a
+// client from shrinking it afterwards and faulting the broker on its next access
+constexpr int segment_seals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+boost::system::error_code last_error() {
+    return boost::system::error_code(errno, boost::system::system_category());
+}
+
+size_t round_capacity(size_t capacity) {
+    size_t rounded = min_ring_capacity;
+    while (rounded < capacity && rounded < max_ring_capacity) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+int own(ShmChannel::Side side) {
+    return static_cast<int>(side);
+}
+
+int other(ShmChannel::Side side) {
+    return 1 - static_cast<int>(side);
+}
+
+void close_fd(int& fd) {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+// Sends the segment and both eventfds over the control socket
+bool send_handoff(int socket, const int (&fds)[3]) {
+    char tag[sizeof(handoff_tag)];
+    std::memcpy(tag, handoff_tag, sizeof(tag));
+    iovec vector{tag, sizeof(tag)};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr message{};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(header), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == static_cast<ssize_t>(sizeof(tag));
+}
+
+// Receives what send_handoff sent; any descriptors received are returned in
+// fds even on failure so the caller can close them
+bool receive_handoff(int socket, int (&fds)[3]) {
+    char tag[sizeof(handoff_tag)];
+    iovec vector{tag, sizeof(tag)};
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))] = {};
+    msghdr message{};
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = ::recvmsg(socket, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0) {
+        return false;
+    }
+
+    errno = EPROTO;
+    for (cmsghdr* header = CMSG_FIRSTHDR(&message); header; header = CMSG_NXTHDR(&message, header)) {
+        if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            size_t count = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            std::memcpy(fds, CMSG_DATA(header), std::min<size_t>(count, 3) * sizeof(int));
+            if (count != 3) {
+                return false;
+            }
+        }
+    }
+
+    return received == static_cast<ssize_t>(sizeof(tag)) && (message.msg_flags & MSG_CTRUNC) == 0 &&
+           std::memcmp(tag, handoff_tag, sizeof(tag)) == 0 && fds[2] >= 0;
+}
+
+} // namespace
+
+std::shared_ptr<ShmChannel> ShmChannel::connect(boost::asio::io_context& io_context,
+                                                const std::string& control_path,
+                                                size_t ring_capacity,
+                                                boost::system::error_code& ec) {
+    size_t capacity = round_capacity(ring_capacity);
+    size_t mapping_size = header_size + 2 * capacity;
+
+    boost::asio::local::stream_protocol::socket control(io_context);
+    control.connect(boost::asio::local::stream_protocol::endpoint(control_path), ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    // Anonymous, so nothing is left behind if either side crashes
+    int segment = ::memfd_create("tinymq-shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (segment < 0) {
+        ec = last_error();
+        return nullptr;
+    }
+
+    int client_wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    int broker_wake = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    void* mapping = MAP_FAILED;
+    if (client_wake < 0 || broker_wake < 0 || ::ftruncate(segment, static_cast<off_t>(mapping_size)) != 0 ||
+        ::fcntl(segment, F_ADD_SEALS, segment_seals | F_SEAL_SEAL) != 0 ||
+        (mapping = ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, segment, 0)) == MAP_FAILED) {
+        ec = last_error();
+        close_fd(segment);
+        close_fd(client_wake);
+        close_fd(broker_wake);
+        return nullptr;
+    }
+
+    auto* header = new (mapping) Segment();
+    header->magic = segment_magic;
+    header->version = segment_version;
+    header->capacity = capacity;
+
+    int fds[3] = {segment, client_wake, broker_wake};
+    bool sent = send_handoff(control.native_handle(), fds);
+    if (!sent) {
+        ec = last_error();
+    }
+    close_fd(segment);
+    if (!sent) {
+        ::munmap(mapping, mapping_size);
+        close_fd(client_wake);
+        close_fd(broker_wake);
+        return nullptr;
+    }
+
+    auto executor = control.get_executor();
+    std::shared_ptr<ShmChannel> channel(new ShmChannel(Side::client, executor, mapping, mapping_size, capacity,
+                                                       client_wake, broker_wake, std::move(control)));
+    channel->peer_ = "shm:" + control_path;
+    channel->watch_control();
+    return channel;
+}
+
+std::shared_ptr<ShmChannel> ShmChannel::accept(boost::asio::local::stream_protocol::socket control,
+                                               boost::system::error_code& ec) {
+    int fds[3] = {-1, -1, -1};
+    auto release = [&fds] {
+        for (int& fd : fds) {
+            close_fd(fd);
+        }
+    };
+    if (!receive_handoff(control.native_handle(), fds)) {
+        ec = last_error();
+        release();
+        return nullptr;
+    }
+
+    struct stat info;
+    if (::fstat(fds[0], &info) != 0) {
+        ec = last_error();
+        release();
+        return nullptr;
+    }
+    int seals = ::fcntl(fds[0], F_GET_SEALS);
+    if (seals < 0 || (seals & segment_seals) != segment_seals) {
+        ec = boost::asio::error::access_denied;
+        release();
+        return nullptr;
+    }
+    size_t mapping_size = static_cast<size_t>(info.st_size);
+    void* mapping = mapping_size >= header_size
+        ? ::mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)
+        : MAP_FAILED;
+    if (mapping == MAP_FAILED) {
+        ec = boost::asio::error::invalid_argument;
+        release();
+        return nullptr;
+    }
+
+    auto* header = static_cast<Segment*>(mapping);
+    // Read once: the client can still write the header while it is checked
+    uint64_t capacity = *static_cast<volatile uint64_t*>(&header->capacity);
+    if (header->magic != segment_magic || header->version != segment_version ||
+        capacity < min_ring_capacity || capacity > max_ring_capacity || (capacity & (capacity - 1)) != 0 ||
+        mapping_size != header_size + 2 * capacity) {
+        ::munmap(mapping, mapping_size);
+        ec = boost::asio::error::invalid_argument;
+        release();
+        return nullptr;
+    }
+    close_fd(fds[0]);
+
+    std::string peer = "shm";
+    ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (::getsockopt(control.native_handle(), SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0) {
+        peer += ":pid " + std::to_string(credentials.pid);
+    }
+
+    auto executor = control.get_executor();
+    std::shared_ptr<ShmChannel> channel(new ShmChannel(Side::broker, executor, mapping, mapping_size,
+                                                       static_cast<size_t>(capacity), fds[2], fds[1], std::move(control)));
+    channel->peer_ = std::move(peer);
+    channel->watch_control();
+    return channel;
+}
+
+ShmChannel::ShmChannel(Side side, executor_type executor, void* mapping, size_t mapping_size, size_t capacity,
+                       int own_wake, int peer_wake, boost::asio::local::stream_protocol::socket control)
+    : side_(side),
+      executor_(std::move(executor)),
+      segment_(static_cast<Segment*>(mapping)),
+      mapping_size_(mapping_size),
+      capacity_(capacity),
+      inbound_(static_cast<uint8_t*>(mapping) + header_size + other(side) * capacity),
+      outbound_(static_cast<uint8_t*>(mapping) + header_size + own(side) * capacity),
+      own_wake_(executor_, own_wake),
+      peer_wake_(peer_wake),
+      control_(std::move(control)) {}
+
+ShmChannel::~ShmChannel() {
+    close();
+    ::munmap(segment_, mapping_size_);
+    ::close(peer_wake_);
+}
+
+void ShmChannel::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!open_.exchange(false, std::memory_order_acq_rel)) {
+        return;
+    }
+
+    segment_->closed[own(side_)].store(1);
+    wake_peer();
+
+    boost::system::error_code ec;
+    control_.close(ec);
+    own_wake_.close(ec);
+
+    if (read_op_) {
+        read_op_->perform(*this, boost::asio::error::operation_aborted);
+        read_op_.reset();
+    }
+    if (write_op_) {
+        write_op_->perform(*this, boost::asio::error::operation_aborted);
+        write_op_.reset();
+    }
+}
+
+void ShmChannel::start(std::unique_ptr<PendingOperation>& slot, std::unique_ptr<PendingOperation> operation) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!is_open()) {
+        operation->perform(*this, boost::asio::error::operation_aborted);
+        return;
+    }
+    slot = std::move(operation);
+    progress();
+}
+
+void ShmChannel::progress() {
+    auto& sleeping = segment_->sleeping[own(side_)];
+    for (;;) {
+        if (read_op_ && read_op_->perform(*this, {})) {
+            read_op_.reset();
+        }
+        if (write_op_ && write_op_->perform(*this, {})) {
+            write_op_.reset();
+        }
+        if (!read_op_ && !write_op_) {
+            sleeping.store(0);
+            return;
+        }
+
+        // Announce the sleep before the final check: the peer either sees the
+        // flag and signals, or moved its index early enough for us to see it
+        sleeping.store(1);
+        if (!ready()) {
+            break;
+        }
+        sleeping.store(0);
+    }
+
+    if (sleeping_) {
+        return;
+    }
+    sleeping_ = true;
+    own_wake_.async_read_some(boost::asio::buffer(&wake_count_, sizeof(wake_count_)),
+                              [weak = weak_from_this()](boost::system::error_code ec, size_t) {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        if (ec) {
+            if (ec != boost::asio::error::operation_aborted) {
+                self->close();
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> lock(self->mutex_);
+        self->sleeping_ = false;
+        if (self->is_open()) {
+            self->progress();
+        }
+    });
+}
+
+bool ShmChannel::ready() {
+    if (!is_open() || peer_closed()) {
+        return true;
+    }
+    return (read_op_ && boost::asio::buffer_size(readable_data()) > 0) ||
+           (write_op_ && boost::asio::buffer_size(writable_space()) > 0);
+}
+
+void ShmChannel::watch_control() {
+    // The peer never writes here; the read ends when its process goes away
+    control_.async_read_some(boost::asio::buffer(&control_byte_, 1),
+                             [weak = weak_from_this()](boost::system::error_code ec, size_t) {
+        auto self = weak.lock();
+        if (!self || ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (!ec) {
+            self->watch_control();
+            return;
+        }
+        self->mark_broken();
+    });
+}
+
+void ShmChannel::mark_broken() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    broken_ = true;
+    if (is_open()) {
+        progress();
+    }
+}
+
+std::array<boost::asio::const_buffer, 2> ShmChannel::readable_data() {
+    auto& ring = segment_->rings[other(side_)];
+    uint64_t capacity = capacity_;
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint64_t available = ring.head.load() - tail;
+    if (available > capacity) {
+        broken_ = true;
+        return {};
+    }
+    size_t offset = static_cast<size_t>(tail & (capacity - 1));
+    size_t first = static_cast<size_t>(std::min<uint64_t>(available, capacity - offset));
+    return {boost::asio::const_buffer(inbound_ + offset, first),
+            boost::asio::const_buffer(inbound_, static_cast<size_t>(available) - first)};
+}
+
+void ShmChannel::consume(size_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    auto& ring = segment_->rings[other(side_)];
+    ring.tail.store(ring.tail.load(std::memory_order_relaxed) + bytes);
+    if (segment_->sleeping[other(side_)].load()) {
+        wake_peer();
+    }
+}
+
+std::array<boost::asio::mutable_buffer, 2> ShmChannel::writable_space() {
+    auto& ring = segment_->rings[own(side_)];
+    uint64_t capacity = capacity_;
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    uint64_t used = head - ring.tail.load();
+    if (used > capacity) {
+        broken_ = true;
+        return {};
+    }
+    size_t offset = static_cast<size_t>(head & (capacity - 1));
+    size_t space = static_cast<size_t>(capacity - used);
+    size_t first = std::min(space, static_cast<size_t>(capacity) - offset);
+    return {boost::asio::mutable_buffer(outbound_ + offset, first),
+            boost::asio::mutable_buffer(outbound_, space - first)};
+}
+
+void ShmChannel::produce(size_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    auto& ring = segment_->rings[own(side_)];
+    ring.head.store(ring.head.load(std::memory_order_relaxed) + bytes);
+    if (segment_->sleeping[other(side_)].load()) {
+        wake_peer();
+    }
+}
+
+bool ShmChannel::peer_closed() const {
+    return broken_ || segment_->closed[other(side_)].load() != 0;
+}
+
+void ShmChannel::wake_peer() {
+    uint64_t one = 1;
+    ssize_t written;
+    do {
+        written = ::write(peer_wake_, &one, sizeof(one));
+    } while (written < 0 && errno == EINTR);
+}
+
+} // namespace tinymq
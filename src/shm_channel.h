@@ -0,0 +1,160 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace tinymq {
+
+// Byte stream between a client and the broker on the same machine: two
+// single-producer single-consumer rings in one shared memory segment, one per
+// direction, plus an eventfd per side. A side only signals the other when
+// that side is asleep waiting for data or space, so a busy stream makes no
+// system calls. Carries the same packets as TCP.
+//
+// The client creates the segment as a sealed memfd, so its size is fixed, and
+// passes it with both eventfds to the broker over a Unix domain control socket,
+// which then stays open so either side notices when the other goes away.
+//
+// Implements Asio's AsyncReadStream and AsyncWriteStream, so async_read and
+// async_write work on it unchanged. One read and one write may be pending at
+// a time, from any threads.
+class ShmChannel : public std::enable_shared_from_this<ShmChannel> {
+public:
+    using executor_type = boost::asio::any_io_executor;
+
+    enum class Side { client = 0, broker = 1 };
+
+    static constexpr size_t default_ring_capacity = 1 << 20;
+
+    // Client side: creates the segment and hands it to the broker listening on
+    // control_path. Returns null and sets ec on failure.
+    static std::shared_ptr<ShmChannel> connect(boost::asio::io_context& io_context,
+                                               const std::string& control_path,
+                                               size_t ring_capacity,
+                                               boost::system::error_code& ec);
+
+    // Broker side: adopts the segment a client sent over an accepted control
+    // socket, which must be readable. Returns null and sets ec on failure.
+    static std::shared_ptr<ShmChannel> accept(boost::asio::local::stream_protocol::socket control,
+                                              boost::system::error_code& ec);
+
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel&) = delete;
+    ShmChannel& operator=(const ShmChannel&) = delete;
+
+    executor_type get_executor() { return executor_; }
+    bool is_open() const { return open_.load(std::memory_order_acquire); }
+    // Completes pending operations with operation_aborted and tells the peer
+    void close();
+    const std::string& peer() const { return peer_; }
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        start(read_op_, std::make_unique<Operation<MutableBufferSequence, std::decay_t<ReadHandler>, true>>(
+                            buffers, std::forward<ReadHandler>(handler)));
+    }
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+        start(write_op_, std::make_unique<Operation<ConstBufferSequence, std::decay_t<WriteHandler>, false>>(
+                             buffers, std::forward<WriteHandler>(handler)));
+    }
+
+    struct Segment;
+
+private:
+    // Transfers what it can; once done, posts its handler and returns true
+    class PendingOperation {
+    public:
+        virtual ~PendingOperation() = default;
+        virtual bool perform(ShmChannel& channel, const boost::system::error_code& abort) = 0;
+    };
+
+    template <typename Buffers, typename Handler, bool Read>
+    class Operation : public PendingOperation {
+    public:
+        Operation(const Buffers& buffers, Handler&& handler)
+            : buffers_(buffers), handler_(std::move(handler)) {}
+
+        bool perform(ShmChannel& channel, const boost::system::error_code& abort) override {
+            boost::system::error_code ec = abort;
+            size_t transferred = 0;
+            if (!ec && boost::asio::buffer_size(buffers_) > 0) {
+                if constexpr (Read) {
+                    transferred = boost::asio::buffer_copy(buffers_, channel.readable_data());
+                    channel.consume(transferred);
+                } else {
+                    transferred = boost::asio::buffer_copy(channel.writable_space(), buffers_);
+                    channel.produce(transferred);
+                }
+                if (transferred == 0) {
+                    if (!channel.peer_closed() && channel.is_open()) {
+                        return false;
+                    }
+                    if constexpr (Read) {
+                        ec = boost::asio::error::eof;
+                    } else {
+                        ec = boost::asio::error::broken_pipe;
+                    }
+                }
+            }
+            boost::asio::post(channel.executor_, boost::asio::detail::bind_handler(
+                std::move(handler_), ec, transferred));
+            return true;
+        }
+
+    private:
+        Buffers buffers_;
+        Handler handler_;
+    };
+
+    ShmChannel(Side side, executor_type executor, void* mapping, size_t mapping_size, size_t capacity,
+               int own_wake, int peer_wake, boost::asio::local::stream_protocol::socket control);
+
+    void start(std::unique_ptr<PendingOperation>& slot, std::unique_ptr<PendingOperation> operation);
+    // Completes whatever can complete and sleeps on the eventfd for the rest;
+    // called with mutex_ held
+    void progress();
+    // Whether a pending operation could complete now; called with mutex_ held
+    bool ready();
+    void watch_control();
+
+    // Ring access; the regions wrap around the end of the ring
+    std::array<boost::asio::const_buffer, 2> readable_data();
+    void consume(size_t bytes);
+    std::array<boost::asio::mutable_buffer, 2> writable_space();
+    void produce(size_t bytes);
+    bool peer_closed() const;
+    void mark_broken();
+    void wake_peer();
+
+    Side side_;
+    executor_type executor_;
+    Segment* segment_;
+    size_t mapping_size_;
+    const size_t capacity_;         // Validated once; the segment's copy is the peer's to rewrite
+    uint8_t* inbound_;
+    uint8_t* outbound_;
+    boost::asio::posix::stream_descriptor own_wake_;
+    int peer_wake_;
+    boost::asio::local::stream_protocol::socket control_;
+    std::string peer_;
+    std::atomic<bool> open_{true};
+
+    std::mutex mutex_;
+    std::unique_ptr<PendingOperation> read_op_;
+    std::unique_ptr<PendingOperation> write_op_;
+    bool sleeping_ = false;       // A wait on own_wake_ is pending
+    bool broken_ = false;         // Peer exited or corrupted the segment
+    uint64_t wake_count_ = 0;
+    uint8_t control_byte_ = 0;
+};
+
+} // namespace tinymq
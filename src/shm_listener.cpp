@@ -0,0 +1,133 @@
+#include "shm_listener.h"
+#include "broker.h"
+#include "session.h"
+#include "terminal_ui.h"
+#include <algorithm>
+
+namespace tinymq {
+
+ShmListener::ShmListener(boost::asio::io_context& io_context, const std::string& path, Broker& broker)
+    : acceptor_(io_context, boost::asio::local::stream_protocol::endpoint(path)),
+      accept_timer_(io_context),
+      path_(path),
+      broker_(broker) {
+}
+
+void ShmListener::start() {
+    accept();
+}
+
+void ShmListener::stop() {
+    boost::system::error_code ec;
+    acceptor_.close(ec);
+    accept_timer_.cancel();
+
+    std::vector<std::weak_ptr<ShmChannel>> channels;
+    {
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        channels.swap(channels_);
+    }
+    for (auto& weak : channels) {
+        if (auto channel = weak.lock()) {
+            channel->close();
+        }
+    }
+}
+
+void ShmListener::accept() {
+    // Paced by the admission controller, as in Broker::accept_connections
+    auto delay = broker_.admission().accept_delay();
+    if (delay > AdmissionController::clock::duration::zero()) {
+        accept_timer_.expires_after(delay);
+        accept_timer_.async_wait([this](boost::system::error_code ec) {
+            if (!ec && acceptor_.is_open()) {
+                accept();
+            }
+        });
+        return;
+    }
+    
+    acceptor_.async_accept([this](boost::system::error_code ec, boost::asio::local::stream_protocol::socket socket) {
+        if (ec == boost::asio::error::operation_aborted) {
+            return;
+        }
+        if (ec) {
+            ui::print_message("Broker", "Shared memory accept error: " + ec.message(), ui::MessageType::ERROR);
+        } else {
+            adopt(std::move(socket));
+        }
+        if (acceptor_.is_open()) {
+            accept();
+        }
+    });
+}
+
+void ShmListener::adopt(boost::asio::local::stream_protocol::socket control) {
+    auto& admission = broker_.admission();
+    if (!admission.admit()) {
+        // Dropping the socket closes it
+        ui::print_message("Broker", "Session limit reached, refusing connection",
+                          ui::MessageType::WARNING);
+        return;
+    }
+
+    // The client sends the segment right after connecting. Until then the
+    // connection holds a pending handshake, released here or by its Session.
+    struct PendingHandoff {
+        explicit PendingHandoff(boost::asio::local::stream_protocol::socket socket)
+            : strand(boost::asio::make_strand(socket.get_executor())),
+              control(std::move(socket)),
+              timer(strand) {}
+        boost::asio::strand<boost::asio::any_io_executor> strand;
+        boost::asio::local::stream_protocol::socket control;
+        boost::asio::steady_timer timer;
+    };
+    auto pending = std::make_shared<PendingHandoff>(std::move(control));
+
+    auto timeout = admission.limits().handshake_timeout;
+    if (timeout.count() > 0) {
+        pending->timer.expires_after(timeout);
+        pending->timer.async_wait([pending](boost::system::error_code ec) {
+            if (!ec) {
+                boost::system::error_code close_ec;
+                pending->control.close(close_ec);
+            }
+        });
+    }
+
+    pending->control.async_wait(boost::asio::local::stream_protocol::socket::wait_read,
+                                boost::asio::bind_executor(pending->strand,
+                                                           [this, pending](boost::system::error_code ec) {
+        pending->timer.cancel();
+        if (ec) {
+            if (ec == boost::asio::error::operation_aborted) {
+                ui::print_message("Broker", "Shared memory handoff timed out", ui::MessageType::WARNING);
+            }
+            broker_.admission().session_closed(true);
+            return;
+        }
+
+        auto channel = ShmChannel::accept(std::move(pending->control), ec);
+        if (!channel) {
+            ui::print_message("Broker", "Rejected shared memory channel: " + ec.message(),
+                              ui::MessageType::WARNING);
+            broker_.admission().session_closed(true);
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex_);
+            channels_.erase(std::remove_if(channels_.begin(), channels_.end(),
+                                           [](const std::weak_ptr<ShmChannel>& weak) { return weak.expired(); }),
+                            channels_.end());
+            channels_.push_back(channel);
+        }
+
+        auto session = std::make_shared<Session>(std::move(channel), broker_);
+        ui::print_message("Broker", "New connection from " + session->remote_endpoint(),
+                          ui::MessageType::INCOMING);
+        session->start();
+    }));
+}
+
+} // namespace tinymq
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "shm_channel.h"
+
+namespace tinymq {
+
+class Broker;
+
+// Accepts shared memory sessions: clients connect to a Unix domain socket at
+// path and hand over a ShmChannel segment, which then carries the session
+// instead of the socket. Accepts are paced and admitted like TCP ones, and a
+// connection counts as a pending handshake from the moment it is accepted, so
+// the handoff is bounded by the handshake timeout.
+class ShmListener {
+public:
+    ShmListener(boost::asio::io_context& io_context, const std::string& path, Broker& broker);
+
+    void start();
+    // Closes every open channel so their clients see the broker go away
+    void stop();
+
+    const std::string& path() const { return path_; }
+
+private:
+    void accept();
+    void adopt(boost::asio::local::stream_protocol::socket control);
+
+    boost::asio::local::stream_protocol::acceptor acceptor_;
+    boost::asio::steady_timer accept_timer_;
+    std::string path_;
+    Broker& broker_;
+    std::mutex channels_mutex_;
+    std::vector<std::weak_ptr<ShmChannel>> channels_;
+};
+
+} // namespace tinymq
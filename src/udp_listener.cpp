@@ -0,0 +1,136 @@
+#include "udp_listener.h"
+#include "broker.h"
+#include "metrics.h"
+#include "packet.h"
+#include "terminal_ui.h"
+#include <cerrno>
+#include <string_view>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace tinymq {
+
+namespace {
+
+// Batches handled per wakeup before yielding to the other handlers on the pool
+constexpr size_t batches_per_wakeup = 8;
+
+// Takes the same time wherever the first difference is, so response timing
+// does not reveal how much of a guessed token was right
+bool tokens_equal(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    unsigned char difference = 0;
+    for (size_t i = 0; i < a.size(); ++i) {
+        difference |= static_cast<unsigned char>(a[i] ^ b[i]);
+    }
+    return difference == 0;
+}
+
+} // namespace
+
+UdpListener::UdpListener(boost::asio::io_context& io_context, uint16_t port, Broker& broker,
+                         const std::string& token)
+    : socket_(io_context, boost::asio::ip::udp::endpoint(boost::asio::ip::udp::v4(), port)),
+      broker_(broker),
+      token_(token),
+      buffers_(batch_size * max_datagram_size) {
+    boost::system::error_code ec;
+    socket_.non_blocking(true, ec);
+    // Room for bursts that arrive while every pool thread is busy
+    socket_.set_option(boost::asio::socket_base::receive_buffer_size(4 << 20), ec);
+}
+
+void UdpListener::start() {
+    wait_readable();
+}
+
+void UdpListener::stop() {
+    boost::system::error_code ec;
+    socket_.close(ec);
+}
+
+uint16_t UdpListener::port() const {
+    return socket_.local_endpoint().port();
+}
+
+void UdpListener::wait_readable() {
+    socket_.async_wait(boost::asio::ip::udp::socket::wait_read, [this](boost::system::error_code ec) {
+        if (ec) {
+            if (ec != boost::asio::error::operation_aborted) {
+                ui::print_message("UDP", "Wait error: " + ec.message(), ui::MessageType::ERROR);
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < batches_per_wakeup && receive_batch(); ++i) {
+        }
+
+        if (socket_.is_open()) {
+            wait_readable();
+        }
+    });
+}
+
+bool UdpListener::receive_batch() {
+#if defined(__linux__)
+    mmsghdr messages[batch_size] = {};
+    iovec vectors[batch_size];
+    for (size_t i = 0; i < batch_size; ++i) {
+        vectors[i].iov_base = buffers_.data() + i * max_datagram_size;
+        vectors[i].iov_len = max_datagram_size;
+        messages[i].msg_hdr.msg_iov = &vectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received = ::recvmmsg(socket_.native_handle(), messages, batch_size, MSG_DONTWAIT, nullptr);
+    if (received < 0) {
+        return errno == EINTR;
+    }
+
+    for (int i = 0; i < received; ++i) {
+        handle_datagram(buffers_.data() + i * max_datagram_size, messages[i].msg_len,
+                        (messages[i].msg_hdr.msg_flags & MSG_TRUNC) != 0);
+    }
+    return static_cast<size_t>(received) == batch_size;
+#else
+    for (size_t i = 0; i < batch_size; ++i) {
+        boost::system::error_code ec;
+        size_t length = socket_.receive(boost::asio::buffer(buffers_.data(), max_datagram_size), 0, ec);
+        if (ec == boost::asio::error::message_size) {
+            handle_datagram(buffers_.data(), length, true);
+        } else if (ec) {
+            return false;
+        } else {
+            handle_datagram(buffers_.data(), length, false);
+        }
+    }
+    return true;
+#endif
+}
+
+void UdpListener::handle_datagram(const uint8_t* data, size_t length, bool truncated) {
+    metrics::add(metrics::Counter::BytesIn, length);
+    metrics::add(metrics::Counter::DatagramsIn);
+
+    std::string_view token;
+    std::string_view topic;
+    std::string_view message;
+    if (truncated || !parse_publish_datagram(data, length, token, topic, message) ||
+        (!token_.empty() && !tokens_equal(token, token_))) {
+        metrics::add(metrics::Counter::DatagramsDropped);
+        return;
+    }
+
+    auto received_at = metrics::clock::now();
+    metrics::packet_in(PacketType::PUB);
+    metrics::add(metrics::Counter::MessagesIn);
+
+    broker_.publish(std::string(topic), std::vector<uint8_t>(message.begin(), message.end()), received_at);
+}
+
+} // namespace tinymq
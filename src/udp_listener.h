@@ -0,0 +1,41 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <string>
+#include <vector>
+
+namespace tinymq {
+
+class Broker;
+
+// Accepts fire-and-forget PUB datagrams (see encode_publish_datagram) and
+// routes them like PUBs from a session, without a session or a PUBACK.
+// Datagrams are drained in batches with recvmmsg where available. With a
+// token configured, datagrams without the matching token are dropped, as are
+// malformed ones and any larger than max_datagram_size.
+class UdpListener {
+public:
+    static constexpr size_t batch_size = 32;
+    static constexpr size_t max_datagram_size = 8192;
+
+    UdpListener(boost::asio::io_context& io_context, uint16_t port, Broker& broker,
+                const std::string& token = "");
+
+    void start();
+    void stop();
+
+    uint16_t port() const;
+
+private:
+    void wait_readable();
+    // Returns false once the socket has no more datagrams queued
+    bool receive_batch();
+    void handle_datagram(const uint8_t* data, size_t length, bool truncated);
+
+    boost::asio::ip::udp::socket socket_;
+    Broker& broker_;
+    std::string token_;
+    std::vector<uint8_t> buffers_;   // batch_size slots of max_datagram_size bytes
+};
+
+} // namespace tinymq
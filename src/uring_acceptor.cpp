@@ -0,0 +1,56 @@
+#include "uring_acceptor.h"
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace tinymq {
+
+class UringAcceptor::AcceptRequest : public UringService::Request {
+public:
+    AcceptRequest(UringAcceptor& acceptor, AcceptHandler handler)
+        : acceptor_(acceptor), handler_(std::move(handler)) {}
+
+    void complete(int result, int, bool) override {
+        boost::system::error_code ec;
+        std::shared_ptr<UringStream> stream;
+        if (acceptor_.closed_) {
+            if (result >= 0) {
+                ::close(result);
+            }
+            ec = boost::asio::error::operation_aborted;
+        } else if (result < 0) {
+            ec = boost::system::error_code(-result, boost::system::system_category());
+        } else {
+            stream = std::make_shared<UringStream>(acceptor_.service_, result);
+        }
+        boost::asio::dispatch(acceptor_.service_.context(),
+                              [handler = std::move(handler_), ec, stream]() { handler(ec, stream); });
+    }
+
+private:
+    UringAcceptor& acceptor_;
+    AcceptHandler handler_;
+};
+
+UringAcceptor::UringAcceptor(UringService& service, boost::asio::ip::tcp::acceptor& acceptor)
+    : service_(service), acceptor_(acceptor) {
+}
+
+void UringAcceptor::close() {
+    if (closed_.exchange(true)) {
+        return;
+    }
+    // Wakes the accept in flight; it fails with EINVAL, reported as aborted
+    ::shutdown(acceptor_.native_handle(), SHUT_RDWR);
+}
+
+void UringAcceptor::start_accept(AcceptHandler handler) {
+    if (closed_) {
+        boost::asio::post(service_.context(), [handler = std::move(handler)]() {
+            handler(boost::asio::error::operation_aborted, nullptr);
+        });
+        return;
+    }
+    service_.submit_accept(new AcceptRequest(*this, std::move(handler)), acceptor_.native_handle());
+}
+
+} // namespace tinymq
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "uring_service.h"
+#include "uring_stream.h"
+
+namespace tinymq {
+
+// Accepts on a listening TCP acceptor through a UringService; accepted
+// connections come out as UringStreams. One accept is in flight at a time so
+// the broker's admission pacing still applies between accepts.
+class UringAcceptor {
+public:
+    using AcceptHandler = std::function<void(boost::system::error_code, std::shared_ptr<UringStream>)>;
+
+    // acceptor stays owned by the caller and must outlive this
+    UringAcceptor(UringService& service, boost::asio::ip::tcp::acceptor& acceptor);
+
+    template <typename Handler>
+    void async_accept(Handler&& handler) {
+        start_accept(AcceptHandler(std::forward<Handler>(handler)));
+    }
+
+    // The accept in flight completes with operation_aborted; call before
+    // closing the acceptor
+    void close();
+
+private:
+    class AcceptRequest;
+
+    void start_accept(AcceptHandler handler);
+
+    UringService& service_;
+    boost::asio::ip::tcp::acceptor& acceptor_;
+    std::atomic<bool> closed_{false};
+};
+
+} // namespace tinymq
@@ -0,0 +1,443 @@
+#include "uring_service.h"
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#if defined(TINYMQ_HAS_IO_URING)
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace tinymq {
+
+#if defined(TINYMQ_HAS_IO_URING)
+
+namespace {
+
+// Completions handled per wakeup before yielding to the other handlers on the pool
+constexpr int reap_rounds = 4;
+
+int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, 0, flags, nullptr, 0));
+}
+
+int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+std::system_error uring_error(const char* what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+template <typename T>
+T load_acquire(const T* value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+template <typename T>
+void store_release(T* value, T update) {
+    __atomic_store_n(value, update, __ATOMIC_RELEASE);
+}
+
+void* map_ring(size_t size, int fd, off_t offset) {
+    return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+}
+
+} // namespace
+
+// The mapped submission and completion queues and the provided buffer ring
+struct UringService::Ring {
+    int fd = -1;
+    int wake_fd = -1;
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_size = 0;
+    void* sqe_map = MAP_FAILED;
+    size_t sqe_map_size = 0;
+    void* buffer_map = MAP_FAILED;
+    size_t buffer_map_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_flags = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    io_uring_sqe* sqes = nullptr;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    io_uring_buf_ring* buffers = nullptr;
+    uint16_t buffer_tail = 0;
+
+    ~Ring() {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        if (wake_fd >= 0) {
+            ::close(wake_fd);
+        }
+        if (buffer_map != MAP_FAILED) {
+            ::munmap(buffer_map, buffer_map_size);
+        }
+        if (sqe_map != MAP_FAILED) {
+            ::munmap(sqe_map, sqe_map_size);
+        }
+        if (cq_map != MAP_FAILED && cq_map != sq_map) {
+            ::munmap(cq_map, cq_map_size);
+        }
+        if (sq_map != MAP_FAILED) {
+            ::munmap(sq_map, sq_map_size);
+        }
+    }
+
+    // Queues a provided buffer; visible to the kernel after publish_buffers()
+    void add_buffer(uint8_t* data, int id) {
+        auto* entry = reinterpret_cast<io_uring_buf*>(buffers) + (buffer_tail & (buffer_count - 1));
+        // Only these fields: the ring's tail overlays the first entry's resv
+        entry->addr = reinterpret_cast<uintptr_t>(data);
+        entry->len = static_cast<uint32_t>(buffer_size);
+        entry->bid = static_cast<uint16_t>(id);
+        ++buffer_tail;
+    }
+
+    void publish_buffers() {
+        store_release(&buffers->tail, buffer_tail);
+    }
+};
+
+UringService::UringService(boost::asio::io_context& io_context)
+    : io_context_(io_context),
+      ring_(std::make_unique<Ring>()),
+      buffers_(buffer_count * buffer_size) {
+    Ring& ring = *ring_;
+
+    io_uring_params params{};
+    ring.fd = io_uring_setup(ring_entries, &params);
+    if (ring.fd < 0) {
+        throw uring_error("io_uring_setup");
+    }
+
+    ring.sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring.cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_map) {
+        ring.sq_map_size = ring.cq_map_size = std::max(ring.sq_map_size, ring.cq_map_size);
+    }
+    ring.sq_map = map_ring(ring.sq_map_size, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sq_map == MAP_FAILED) {
+        throw uring_error("mmap submission queue");
+    }
+    ring.cq_map = single_map ? ring.sq_map : map_ring(ring.cq_map_size, ring.fd, IORING_OFF_CQ_RING);
+    if (ring.cq_map == MAP_FAILED) {
+        throw uring_error("mmap completion queue");
+    }
+    ring.sqe_map_size = params.sq_entries * sizeof(io_uring_sqe);
+    ring.sqe_map = map_ring(ring.sqe_map_size, ring.fd, IORING_OFF_SQES);
+    if (ring.sqe_map == MAP_FAILED) {
+        throw uring_error("mmap submission entries");
+    }
+
+    auto* sq = static_cast<uint8_t*>(ring.sq_map);
+    ring.sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    ring.sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    ring.sq_flags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    ring.sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    ring.sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    ring.sq_entries = params.sq_entries;
+    ring.sqes = static_cast<io_uring_sqe*>(ring.sqe_map);
+
+    auto* cq = static_cast<uint8_t*>(ring.cq_map);
+    ring.cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    ring.cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    ring.cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    ring.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    ring.buffer_map_size = buffer_count * sizeof(io_uring_buf);
+    ring.buffer_map = ::mmap(nullptr, ring.buffer_map_size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring.buffer_map == MAP_FAILED) {
+        throw uring_error("mmap buffer ring");
+    }
+    ring.buffers = static_cast<io_uring_buf_ring*>(ring.buffer_map);
+
+    io_uring_buf_reg registration{};
+    registration.ring_addr = reinterpret_cast<uintptr_t>(ring.buffers);
+    registration.ring_entries = buffer_count;
+    registration.bgid = 0;
+    if (io_uring_register(ring.fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        throw uring_error("register buffer ring");
+    }
+    for (unsigned id = 0; id < buffer_count; ++id) {
+        ring.add_buffer(buffers_.data() + id * buffer_size, static_cast<int>(id));
+    }
+    ring.publish_buffers();
+
+    ring.wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring.wake_fd < 0 || io_uring_register(ring.fd, IORING_REGISTER_EVENTFD, &ring.wake_fd, 1) < 0) {
+        throw uring_error("register eventfd");
+    }
+}
+
+UringService::~UringService() {
+    stop();
+}
+
+void UringService::start() {
+    // A duplicate, so that stop() can drop the descriptor while the ring keeps its eventfd
+    int wake_fd = ::fcntl(ring_->wake_fd, F_DUPFD_CLOEXEC, 0);
+    if (wake_fd < 0) {
+        throw uring_error("dup eventfd");
+    }
+    wake_ = std::make_unique<boost::asio::posix::stream_descriptor>(io_context_, wake_fd);
+    wait_completions();
+}
+
+void UringService::stop() {
+    wake_.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(submit_mutex_);
+        if (ring_->fd >= 0) {
+            // Closing the ring cancels whatever is still in flight in the kernel
+            ::close(ring_->fd);
+            ring_->fd = -1;
+        }
+    }
+
+    // Deleted without completing, outside the locks: they release their streams
+    Request* request;
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        request = requests_;
+        requests_ = nullptr;
+    }
+    while (request) {
+        Request* next = request->next_;
+        delete request;
+        request = next;
+    }
+}
+
+void UringService::submit_accept(Request* request, int fd) {
+    io_uring_sqe entry{};
+    entry.opcode = IORING_OP_ACCEPT;
+    entry.fd = fd;
+    entry.accept_flags = SOCK_CLOEXEC;
+    enqueue(request, entry);
+}
+
+void UringService::submit_multishot_receive(Request* request, int fd) {
+    io_uring_sqe entry{};
+    entry.opcode = IORING_OP_RECV;
+    entry.fd = fd;
+    entry.ioprio = IORING_RECV_MULTISHOT;
+    entry.flags = IOSQE_BUFFER_SELECT;
+    entry.buf_group = 0;
+    enqueue(request, entry);
+}
+
+void UringService::submit_receive(Request* request, int fd, msghdr* message) {
+    io_uring_sqe entry{};
+    entry.opcode = IORING_OP_RECVMSG;
+    entry.fd = fd;
+    entry.addr = reinterpret_cast<uintptr_t>(message);
+    entry.len = 1;
+    enqueue(request, entry);
+}
+
+void UringService::submit_send(Request* request, int fd, msghdr* message) {
+    io_uring_sqe entry{};
+    entry.opcode = IORING_OP_SENDMSG;
+    entry.fd = fd;
+    entry.addr = reinterpret_cast<uintptr_t>(message);
+    entry.len = 1;
+    entry.msg_flags = MSG_NOSIGNAL;
+    enqueue(request, entry);
+}
+
+void UringService::recycle(int id) {
+    std::lock_guard<std::mutex> lock(buffer_mutex_);
+    ring_->add_buffer(buffers_.data() + static_cast<size_t>(id) * buffer_size, id);
+    ring_->publish_buffers();
+}
+
+void UringService::enqueue(Request* request, const io_uring_sqe& entry) {
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex_);
+        request->prev_ = nullptr;
+        request->next_ = requests_;
+        if (requests_) {
+            requests_->prev_ = request;
+        }
+        requests_ = request;
+    }
+
+    Ring& ring = *ring_;
+    if (ring.fd < 0) {
+        // Stopped; the request is deleted with the service
+        return;
+    }
+
+    unsigned tail = *ring.sq_tail;
+    if (tail - load_acquire(ring.sq_head) >= ring.sq_entries) {
+        enter();
+        if (tail - load_acquire(ring.sq_head) >= ring.sq_entries) {
+            // The kernel is refusing entries; fail this one rather than wait here
+            boost::asio::post(io_context_, [this, request]() {
+                request->complete(-EBUSY, -1, false);
+                forget(request);
+            });
+            return;
+        }
+    }
+
+    unsigned index = tail & ring.sq_mask;
+    ring.sqes[index] = entry;
+    ring.sqes[index].user_data = reinterpret_cast<uintptr_t>(request);
+    ring.sq_array[index] = index;
+    store_release(ring.sq_tail, tail + 1);
+
+    if (!flush_posted_) {
+        flush_posted_ = true;
+        boost::asio::post(io_context_, [this]() { flush(); });
+    }
+}
+
+void UringService::enter() {
+    Ring& ring = *ring_;
+    while (ring.fd >= 0) {
+        unsigned pending = *ring.sq_tail - load_acquire(ring.sq_head);
+        if (pending == 0) {
+            return;
+        }
+        int submitted = io_uring_enter(ring.fd, pending, 0);
+        if (submitted < 0 && errno == EINTR) {
+            continue;
+        }
+        if (submitted <= 0) {
+            return;
+        }
+    }
+}
+
+void UringService::flush() {
+    std::lock_guard<std::mutex> lock(submit_mutex_);
+    flush_posted_ = false;
+    enter();
+}
+
+void UringService::wait_completions() {
+    wake_->async_read_some(boost::asio::buffer(&wake_count_, sizeof(wake_count_)),
+                           [this](boost::system::error_code ec, size_t) {
+        if (ec) {
+            return;
+        }
+        reap();
+        // Entries queued by the handlers above go out in one batch
+        flush();
+        if (wake_) {
+            wait_completions();
+        }
+    });
+}
+
+void UringService::reap() {
+    struct Completion {
+        Request* request;
+        int result;
+        uint32_t flags;
+    };
+
+    Ring& ring = *ring_;
+    std::vector<Completion> batch;
+    for (int round = 0; round < reap_rounds; ++round) {
+        unsigned head = *ring.cq_head;
+        unsigned tail = load_acquire(ring.cq_tail);
+        if (head == tail) {
+            if ((load_acquire(ring.sq_flags) & IORING_SQ_CQ_OVERFLOW) == 0) {
+                return;
+            }
+            // Completions the kernel could not fit are moved in on request
+            io_uring_enter(ring.fd, 0, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        batch.clear();
+        for (; head != tail; ++head) {
+            const io_uring_cqe& cqe = ring.cqes[head & ring.cq_mask];
+            batch.push_back({reinterpret_cast<Request*>(cqe.user_data), cqe.res, cqe.flags});
+        }
+        store_release(ring.cq_head, head);
+
+        for (const auto& completion : batch) {
+            bool more = (completion.flags & IORING_CQE_F_MORE) != 0;
+            int buffer = (completion.flags & IORING_CQE_F_BUFFER) != 0
+                ? static_cast<int>(completion.flags >> IORING_CQE_BUFFER_SHIFT)
+                : -1;
+            completion.request->complete(completion.result, buffer, more);
+            if (!more) {
+                forget(completion.request);
+            }
+        }
+    }
+}
+
+void UringService::forget(Request* request) {
+    {
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        if (request->prev_) {
+            request->prev_->next_ = request->next_;
+        } else {
+            requests_ = request->next_;
+        }
+        if (request->next_) {
+            request->next_->prev_ = request->prev_;
+        }
+    }
+    delete request;
+}
+
+#else
+
+struct UringService::Ring {};
+
+UringService::UringService(boost::asio::io_context& io_context) : io_context_(io_context) {
+    throw std::system_error(std::make_error_code(std::errc::function_not_supported),
+                            "built without io_uring support");
+}
+
+UringService::~UringService() = default;
+
+void UringService::start() {}
+void UringService::stop() {}
+void UringService::submit_accept(Request*, int) {}
+void UringService::submit_multishot_receive(Request*, int) {}
+void UringService::submit_receive(Request*, int, msghdr*) {}
+void UringService::submit_send(Request*, int, msghdr*) {}
+void UringService::recycle(int) {}
+void UringService::enqueue(Request*, const io_uring_sqe&) {}
+void UringService::enter() {}
+void UringService::flush() {}
+void UringService::wait_completions() {}
+void UringService::reap() {}
+void UringService::forget(Request*) {}
+
+#endif
+
+} // namespace tinymq
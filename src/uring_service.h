@@ -0,0 +1,102 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct io_uring_sqe;
+struct msghdr;
+
+namespace tinymq {
+
+// One io_uring instance for the broker's optional io_uring network backend
+// (see Broker::enable_io_uring). Entries queued by any session go to the
+// kernel in one io_uring_enter per batch: once per reap, or once per
+// io_context turn otherwise. Completions are reaped on the io_context when
+// the ring's registered eventfd fires. Receives draw from a ring of buffers
+// registered with the kernel, so a multishot receive holds no memory until
+// data arrives.
+//
+// Only built with TINYMQ_HAS_IO_URING. Without it, or when the kernel lacks
+// provided buffer rings (Linux 5.19), the constructor throws
+// std::system_error.
+class UringService {
+public:
+    static constexpr unsigned ring_entries = 4096;
+    static constexpr unsigned buffer_count = 4096;   // Power of two
+    static constexpr size_t buffer_size = 4096;
+
+    // Target of a submitted entry. The service deletes it after its last
+    // completion; entries still in flight when the service is destroyed are
+    // deleted without completing.
+    class Request {
+    public:
+        virtual ~Request() = default;
+        // result is a byte count, a file descriptor or -errno. buffer is the
+        // provided buffer holding received data, or -1. more is set while a
+        // multishot request has further completions to come.
+        virtual void complete(int result, int buffer, bool more) = 0;
+
+    private:
+        friend class UringService;
+        Request* prev_ = nullptr;
+        Request* next_ = nullptr;
+    };
+
+    explicit UringService(boost::asio::io_context& io_context);
+    ~UringService();
+
+    UringService(const UringService&) = delete;
+    UringService& operator=(const UringService&) = delete;
+
+    // Reaps completions on the io_context until stop()
+    void start();
+    void stop();
+
+    boost::asio::io_context& context() { return io_context_; }
+
+    // Each takes ownership of request; message must stay valid until it completes
+    void submit_accept(Request* request, int fd);
+    void submit_multishot_receive(Request* request, int fd);
+    void submit_receive(Request* request, int fd, msghdr* message);
+    void submit_send(Request* request, int fd, msghdr* message);
+
+    // Kernels before 6.0 reject multishot receives; streams then receive directly
+    bool multishot_receive() const { return multishot_receive_.load(std::memory_order_relaxed); }
+    void disable_multishot_receive() { multishot_receive_.store(false, std::memory_order_relaxed); }
+
+    const uint8_t* buffer(int id) const { return buffers_.data() + static_cast<size_t>(id) * buffer_size; }
+    // Hands a provided buffer back to the kernel
+    void recycle(int id);
+
+private:
+    struct Ring;
+
+    void enqueue(Request* request, const io_uring_sqe& entry);
+    // Sends queued entries to the kernel; called with submit_mutex_ held
+    void enter();
+    void flush();
+    void wait_completions();
+    void reap();
+    void forget(Request* request);
+
+    boost::asio::io_context& io_context_;
+    std::unique_ptr<Ring> ring_;
+    std::vector<uint8_t> buffers_;
+    std::atomic<bool> multishot_receive_{true};
+
+    std::mutex submit_mutex_;
+    bool flush_posted_ = false;
+    std::mutex buffer_mutex_;
+    std::mutex requests_mutex_;
+    Request* requests_ = nullptr;   // Every request in flight, for cleanup
+
+    std::unique_ptr<boost::asio::posix::stream_descriptor> wake_;
+    uint64_t wake_count_ = 0;
+};
+
+} // namespace tinymq
@@ -0,0 +1,325 @@
+#include "uring_stream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace tinymq {
+
+namespace {
+
+boost::system::error_code from_result(int result) {
+    return boost::system::error_code(-result, boost::system::system_category());
+}
+
+} // namespace
+
+// Holds the stream alive while its request is in the kernel
+class UringStream::ReceiveRequest : public UringService::Request {
+public:
+    explicit ReceiveRequest(std::shared_ptr<UringStream> stream) : stream_(std::move(stream)) {}
+
+    ~ReceiveRequest() override {
+        if (!done_) {
+            stream_->abandon(true);
+        }
+    }
+
+    void complete(int result, int buffer, bool more) override {
+        done_ = !more;
+        stream_->on_receive(result, buffer, more);
+    }
+
+private:
+    std::shared_ptr<UringStream> stream_;
+    bool done_ = false;
+};
+
+class UringStream::DirectReceiveRequest : public UringService::Request {
+public:
+    DirectReceiveRequest(std::shared_ptr<UringStream> stream, std::vector<iovec>& vectors)
+        : stream_(std::move(stream)) {
+        message.msg_iov = vectors.data();
+        message.msg_iovlen = vectors.size();
+    }
+
+    ~DirectReceiveRequest() override {
+        if (!done_) {
+            stream_->abandon(true);
+        }
+    }
+
+    void complete(int result, int, bool) override {
+        done_ = true;
+        stream_->on_direct_receive(result);
+    }
+
+    msghdr message{};
+
+private:
+    std::shared_ptr<UringStream> stream_;
+    bool done_ = false;
+};
+
+class UringStream::SendRequest : public UringService::Request {
+public:
+    SendRequest(std::shared_ptr<UringStream> stream, std::vector<iovec>& vectors)
+        : stream_(std::move(stream)) {
+        message.msg_iov = vectors.data();
+        message.msg_iovlen = vectors.size();
+    }
+
+    ~SendRequest() override {
+        if (!done_) {
+            stream_->abandon(false);
+        }
+    }
+
+    void complete(int result, int, bool) override {
+        done_ = true;
+        stream_->on_sent(result);
+    }
+
+    msghdr message{};
+
+private:
+    std::shared_ptr<UringStream> stream_;
+    bool done_ = false;
+};
+
+size_t UringStream::PendingOperation::fill(const uint8_t* data, size_t length) {
+    size_t copied = 0;
+    size_t skip = transferred;
+    for (const auto& vector : vectors) {
+        if (copied == length) {
+            break;
+        }
+        if (skip >= vector.iov_len) {
+            skip -= vector.iov_len;
+            continue;
+        }
+        size_t count = std::min(vector.iov_len - skip, length - copied);
+        std::memcpy(static_cast<uint8_t*>(vector.iov_base) + skip, data + copied, count);
+        copied += count;
+        skip = 0;
+    }
+    transferred += copied;
+    return copied;
+}
+
+UringStream::UringStream(UringService& service, int fd)
+    : service_(service),
+      executor_(service.context().get_executor()),
+      fd_(fd) {
+}
+
+UringStream::~UringStream() {
+    for (const auto& chunk : chunks_) {
+        service_.recycle(chunk.buffer);
+    }
+    ::close(fd_);
+}
+
+void UringStream::close() {
+    std::unique_ptr<PendingOperation> aborted;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_.exchange(false)) {
+            return;
+        }
+        // Ends the receive and send in flight; the descriptor itself stays
+        // valid until the last request holding this stream is gone
+        ::shutdown(fd_, SHUT_RDWR);
+        if (!direct_) {
+            aborted = std::move(read_op_);
+        }
+    }
+    if (aborted) {
+        aborted->complete(executor_, boost::asio::error::operation_aborted, 0, true);
+    }
+}
+
+boost::asio::ip::tcp::endpoint UringStream::remote_endpoint(boost::system::error_code& ec) const {
+    boost::asio::ip::tcp::endpoint endpoint;
+    socklen_t length = static_cast<socklen_t>(endpoint.capacity());
+    if (::getpeername(fd_, endpoint.data(), &length) < 0) {
+        ec = boost::system::error_code(errno, boost::system::system_category());
+        return {};
+    }
+    endpoint.resize(length);
+    ec = {};
+    return endpoint;
+}
+
+void UringStream::start_read(std::unique_ptr<PendingOperation> operation) {
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_) {
+            completion.operation = std::move(operation);
+            completion.ec = boost::asio::error::operation_aborted;
+        } else if (operation->vectors.empty()) {
+            completion.operation = std::move(operation);
+        } else {
+            read_op_ = std::move(operation);
+            completion = advance_read();
+        }
+    }
+    finish(std::move(completion), true);
+}
+
+void UringStream::start_write(std::unique_ptr<PendingOperation> operation) {
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!open_) {
+            completion.operation = std::move(operation);
+            completion.ec = boost::asio::error::operation_aborted;
+        } else if (operation->vectors.empty()) {
+            completion.operation = std::move(operation);
+        } else {
+            write_op_ = std::move(operation);
+            auto* request = new SendRequest(shared_from_this(), write_op_->vectors);
+            service_.submit_send(request, fd_, &request->message);
+        }
+    }
+    finish(std::move(completion), true);
+}
+
+UringStream::Completion UringStream::advance_read() {
+    Completion completion;
+    if (!read_op_ || direct_) {
+        return completion;
+    }
+
+    if (!chunks_.empty()) {
+        while (!chunks_.empty()) {
+            Chunk& chunk = chunks_.front();
+            size_t copied = read_op_->fill(service_.buffer(chunk.buffer) + chunk.offset, chunk.length);
+            chunk.offset += copied;
+            chunk.length -= copied;
+            if (chunk.length > 0) {
+                break;
+            }
+            service_.recycle(chunk.buffer);
+            chunks_.pop_front();
+        }
+        completion.transferred = read_op_->transferred;
+        completion.operation = std::move(read_op_);
+        return completion;
+    }
+
+    if (read_error_ || eof_) {
+        completion.ec = read_error_ ? read_error_ : boost::asio::error::eof;
+        completion.operation = std::move(read_op_);
+        return completion;
+    }
+
+    if (receiving_) {
+        return completion;
+    }
+
+    if (service_.multishot_receive() && !starved_) {
+        receiving_ = true;
+        service_.submit_multishot_receive(new ReceiveRequest(shared_from_this()), fd_);
+    } else {
+        direct_ = true;
+        starved_ = false;
+        auto* request = new DirectReceiveRequest(shared_from_this(), read_op_->vectors);
+        service_.submit_receive(request, fd_, &request->message);
+    }
+    return completion;
+}
+
+void UringStream::finish(Completion completion, bool defer) {
+    if (completion.operation) {
+        completion.operation->complete(executor_, completion.ec, completion.transferred, defer);
+    }
+}
+
+void UringStream::on_receive(int result, int buffer, bool more) {
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!more) {
+            receiving_ = false;
+        }
+        if (result > 0 && buffer >= 0) {
+            chunks_.push_back({buffer, 0, static_cast<size_t>(result)});
+        } else {
+            if (buffer >= 0) {
+                service_.recycle(buffer);
+            }
+            if (result == 0) {
+                eof_ = true;
+            } else if (result == -ENOBUFS) {
+                starved_ = true;
+            } else if (result == -EINVAL) {
+                service_.disable_multishot_receive();
+            } else if (result < 0) {
+                read_error_ = from_result(result);
+            }
+        }
+        if (open_) {
+            completion = advance_read();
+        }
+    }
+    finish(std::move(completion), false);
+}
+
+void UringStream::on_direct_receive(int result) {
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        direct_ = false;
+        if (result > 0) {
+            read_op_->transferred = static_cast<size_t>(result);
+            completion.transferred = read_op_->transferred;
+            completion.operation = std::move(read_op_);
+        } else if (!open_) {
+            completion.ec = boost::asio::error::operation_aborted;
+            completion.operation = std::move(read_op_);
+        } else if (result == -EINTR || result == -EAGAIN) {
+            completion = advance_read();
+        } else {
+            if (result == 0) {
+                eof_ = true;
+            } else {
+                read_error_ = from_result(result);
+            }
+            completion = advance_read();
+        }
+    }
+    finish(std::move(completion), false);
+}
+
+void UringStream::on_sent(int result) {
+    Completion completion;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completion.operation = std::move(write_op_);
+        if (result < 0) {
+            completion.ec = from_result(result);
+        } else {
+            completion.transferred = static_cast<size_t>(result);
+        }
+    }
+    finish(std::move(completion), false);
+}
+
+void UringStream::abandon(bool read) {
+    std::unique_ptr<PendingOperation> operation;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (read) {
+            receiving_ = false;
+            direct_ = false;
+            operation = std::move(read_op_);
+        } else {
+            operation = std::move(write_op_);
+        }
+    }
+}
+
+} // namespace tinymq
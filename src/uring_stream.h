@@ -0,0 +1,150 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <sys/uio.h>
+#include "uring_service.h"
+
+namespace tinymq {
+
+// A connected TCP socket driven through a UringService instead of the
+// io_context's reactor. Reads are served from a multishot receive into the
+// service's provided buffers; when those run out, or the kernel cannot
+// multishot, a read receives straight into the caller's buffers instead.
+//
+// Implements Asio's AsyncReadStream and AsyncWriteStream, so async_read and
+// async_write work on it unchanged. One read and one write may be pending at
+// a time, from any threads.
+class UringStream : public std::enable_shared_from_this<UringStream> {
+public:
+    using executor_type = boost::asio::any_io_executor;
+
+    // Takes ownership of fd
+    UringStream(UringService& service, int fd);
+    ~UringStream();
+
+    UringStream(const UringStream&) = delete;
+    UringStream& operator=(const UringStream&) = delete;
+
+    executor_type get_executor() { return executor_; }
+    bool is_open() const { return open_.load(std::memory_order_acquire); }
+    // Shuts the socket down; a pending read completes with operation_aborted
+    // unless the kernel is receiving into its buffers, then with what it got
+    void close();
+    boost::asio::ip::tcp::endpoint remote_endpoint(boost::system::error_code& ec) const;
+
+    template <typename MutableBufferSequence, typename ReadHandler>
+    void async_read_some(const MutableBufferSequence& buffers, ReadHandler&& handler) {
+        auto operation = std::make_unique<Operation<std::decay_t<ReadHandler>>>(std::forward<ReadHandler>(handler));
+        operation->assign(buffers);
+        start_read(std::move(operation));
+    }
+
+    template <typename ConstBufferSequence, typename WriteHandler>
+    void async_write_some(const ConstBufferSequence& buffers, WriteHandler&& handler) {
+        auto operation = std::make_unique<Operation<std::decay_t<WriteHandler>>>(std::forward<WriteHandler>(handler));
+        operation->assign(buffers);
+        start_write(std::move(operation));
+    }
+
+private:
+    class ReceiveRequest;
+    class DirectReceiveRequest;
+    class SendRequest;
+
+    class PendingOperation {
+    public:
+        static constexpr size_t max_vectors = 64;
+
+        virtual ~PendingOperation() = default;
+        // Posts the handler when defer is set, otherwise dispatches it
+        virtual void complete(const executor_type& executor, const boost::system::error_code& ec,
+                              size_t transferred, bool defer) = 0;
+
+        template <typename Buffers>
+        void assign(const Buffers& buffers) {
+            auto end = boost::asio::buffer_sequence_end(buffers);
+            for (auto it = boost::asio::buffer_sequence_begin(buffers);
+                 it != end && vectors.size() < max_vectors; ++it) {
+                auto buffer = *it;
+                if (buffer.size() > 0) {
+                    vectors.push_back({const_cast<void*>(static_cast<const void*>(buffer.data())), buffer.size()});
+                }
+            }
+        }
+
+        // Copies received bytes into the caller's buffers after transferred
+        size_t fill(const uint8_t* data, size_t length);
+
+        std::vector<iovec> vectors;
+        size_t transferred = 0;
+    };
+
+    template <typename Handler>
+    class Operation : public PendingOperation {
+    public:
+        explicit Operation(Handler&& handler) : handler_(std::move(handler)) {}
+
+        void complete(const executor_type& executor, const boost::system::error_code& ec,
+                      size_t transferred, bool defer) override {
+            auto bound = boost::asio::detail::bind_handler(std::move(handler_), ec, transferred);
+            if (defer) {
+                boost::asio::post(executor, std::move(bound));
+            } else {
+                boost::asio::dispatch(executor, std::move(bound));
+            }
+        }
+
+    private:
+        Handler handler_;
+    };
+
+    // An operation ready to complete, handed out of the lock
+    struct Completion {
+        std::unique_ptr<PendingOperation> operation;
+        boost::system::error_code ec;
+        size_t transferred = 0;
+    };
+
+    struct Chunk {
+        int buffer;
+        size_t offset;
+        size_t length;
+    };
+
+    void start_read(std::unique_ptr<PendingOperation> operation);
+    void start_write(std::unique_ptr<PendingOperation> operation);
+    // Serves the pending read from received data, or arms a receive for it;
+    // called with mutex_ held
+    Completion advance_read();
+    void finish(Completion completion, bool defer);
+
+    void on_receive(int result, int buffer, bool more);
+    void on_direct_receive(int result);
+    void on_sent(int result);
+    // A request was dropped without completing; its operation is destroyed unrun
+    void abandon(bool read);
+
+    UringService& service_;
+    executor_type executor_;
+    int fd_;
+    std::atomic<bool> open_{true};
+
+    std::mutex mutex_;
+    std::unique_ptr<PendingOperation> read_op_;
+    std::unique_ptr<PendingOperation> write_op_;
+    std::deque<Chunk> chunks_;      // Received into provided buffers, not yet read
+    bool receiving_ = false;        // A multishot receive is armed
+    bool direct_ = false;           // The kernel is receiving into read_op_'s buffers
+    bool starved_ = false;          // Provided buffers ran out; receive directly once
+    bool eof_ = false;
+    boost::system::error_code read_error_;
+};
+
+} // namespace tinymq